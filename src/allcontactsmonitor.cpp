@@ -26,24 +26,44 @@
 
 using namespace KPeople;
 
+ContactVisitor::~ContactVisitor()
+{
+}
+
 class KPeople::AllContactsMonitorPrivate
 {
   public:
     AllContactsMonitorPrivate():
-        m_initialFetchDone(false),
-        m_initialFetchSucccess(false)
+        m_loadState(AllContactsMonitor::InitialLoad),
+        m_loadedCount(0),
+        m_expectedCount(-1),
+        m_emittingBatch(false),
+        m_contactsSnapshotValid(false)
     {
     }
 
-    bool m_initialFetchDone;
-    bool m_initialFetchSucccess;
+    AllContactsMonitor::LoadState m_loadState;
+    int m_loadedCount;
+    int m_expectedCount;
+    //set while the per-contact signals of a batch are emitted, they must not be forwarded again
+    bool m_emittingBatch;
+
+    //what contacts() returned, for the default lookups; dropped on every change
+    KABC::Addressee::Map m_contactsSnapshot;
+    bool m_contactsSnapshotValid;
 };
 
 AllContactsMonitor::AllContactsMonitor():
     QObject(),
     d_ptr(new AllContactsMonitorPrivate)
 {
+    connect(this, SIGNAL(contactAdded(QString,KABC::Addressee)), SLOT(forwardContactAdded(QString,KABC::Addressee)));
+    connect(this, SIGNAL(contactChanged(QString,KABC::Addressee)), SLOT(forwardContactChanged(QString,KABC::Addressee)));
+    connect(this, SIGNAL(contactRemoved(QString)), SLOT(forwardContactRemoved(QString)));
 
+    connect(this, SIGNAL(contactsAdded(KABC::Addressee::Map)), SLOT(dropContactsSnapshot()));
+    connect(this, SIGNAL(contactsChanged(KABC::Addressee::Map)), SLOT(dropContactsSnapshot()));
+    connect(this, SIGNAL(contactsRemoved(QStringList)), SLOT(dropContactsSnapshot()));
 }
 AllContactsMonitor::~AllContactsMonitor()
 {
@@ -55,23 +75,163 @@ KABC::Addressee::Map AllContactsMonitor::contacts()
     return KABC::Addressee::Map();
 }
 
+const KABC::Addressee::Map& AllContactsMonitor::contactsSnapshot()
+{
+    //subclasses which don't reimplement the lookups might build the map in contacts(),
+    //so it is only asked for once between two changes. During the initial load contacts()
+    //may fill up without any signal, it is only kept once that is done
+    if (!d_ptr->m_contactsSnapshotValid) {
+        d_ptr->m_contactsSnapshot = contacts();
+        d_ptr->m_contactsSnapshotValid = isInitialFetchComplete();
+    }
+    return d_ptr->m_contactsSnapshot;
+}
+
+void AllContactsMonitor::dropContactsSnapshot()
+{
+    d_ptr->m_contactsSnapshot.clear();
+    d_ptr->m_contactsSnapshotValid = false;
+}
+
+KABC::Addressee AllContactsMonitor::contact(const QString &contactId)
+{
+    return contactsSnapshot().value(contactId);
+}
+
+bool AllContactsMonitor::contains(const QString &contactId)
+{
+    return contactsSnapshot().contains(contactId);
+}
+
+int AllContactsMonitor::count()
+{
+    return contactsSnapshot().size();
+}
+
+void AllContactsMonitor::visitContacts(ContactVisitor &visitor)
+{
+    //a copy, the visitor could cause a change
+    const KABC::Addressee::Map allContacts = contactsSnapshot();
+    KABC::Addressee::Map::const_iterator it = allContacts.constBegin();
+    for (; it != allContacts.constEnd(); ++it) {
+        visitor.visitContact(it.key(), it.value());
+    }
+}
+
+AllContactsMonitor::LoadState AllContactsMonitor::loadState() const
+{
+    return d_ptr->m_loadState;
+}
+
+int AllContactsMonitor::loadedCount() const
+{
+    return d_ptr->m_loadedCount;
+}
+
+int AllContactsMonitor::expectedCount() const
+{
+    return d_ptr->m_expectedCount;
+}
+
 bool AllContactsMonitor::isInitialFetchComplete() const
 {
-    return d_ptr->m_initialFetchDone;
+    return d_ptr->m_loadState != InitialLoad;
 }
 
 bool AllContactsMonitor::initialFetchSuccess() const
 {
-    return d_ptr->m_initialFetchSucccess;
+    return d_ptr->m_loadState == Loaded;
 }
 
 void AllContactsMonitor::emitInitialFetchComplete(bool success)
 {
-    d_ptr->m_initialFetchDone = true;
-    d_ptr->m_initialFetchSucccess = success;
+    d_ptr->m_loadState = success ? Loaded : LoadFailed;
+    dropContactsSnapshot();
     Q_EMIT initialFetchComplete(success);
 }
 
+void AllContactsMonitor::setLoadProgress(int loaded, int expected)
+{
+    if (loaded == d_ptr->m_loadedCount && expected == d_ptr->m_expectedCount) {
+        return;
+    }
+    d_ptr->m_loadedCount = loaded;
+    d_ptr->m_expectedCount = expected;
+    Q_EMIT loadProgress(loaded, expected);
+}
+
+void AllContactsMonitor::emitContactsAdded(const KABC::Addressee::Map &contacts)
+{
+    if (contacts.isEmpty()) {
+        return;
+    }
+    Q_EMIT contactsAdded(contacts);
+
+    d_ptr->m_emittingBatch = true;
+    KABC::Addressee::Map::const_iterator it = contacts.constBegin();
+    for (; it != contacts.constEnd(); ++it) {
+        Q_EMIT contactAdded(it.key(), it.value());
+    }
+    d_ptr->m_emittingBatch = false;
+}
+
+void AllContactsMonitor::emitContactsChanged(const KABC::Addressee::Map &contacts)
+{
+    if (contacts.isEmpty()) {
+        return;
+    }
+    Q_EMIT contactsChanged(contacts);
+
+    d_ptr->m_emittingBatch = true;
+    KABC::Addressee::Map::const_iterator it = contacts.constBegin();
+    for (; it != contacts.constEnd(); ++it) {
+        Q_EMIT contactChanged(it.key(), it.value());
+    }
+    d_ptr->m_emittingBatch = false;
+}
+
+void AllContactsMonitor::emitContactsRemoved(const QStringList &contactIds)
+{
+    if (contactIds.isEmpty()) {
+        return;
+    }
+    Q_EMIT contactsRemoved(contactIds);
+
+    d_ptr->m_emittingBatch = true;
+    Q_FOREACH (const QString &contactId, contactIds) {
+        Q_EMIT contactRemoved(contactId);
+    }
+    d_ptr->m_emittingBatch = false;
+}
+
+void AllContactsMonitor::forwardContactAdded(const QString &contactId, const KABC::Addressee &contact)
+{
+    dropContactsSnapshot();
+    if (!d_ptr->m_emittingBatch) {
+        KABC::Addressee::Map contacts;
+        contacts.insert(contactId, contact);
+        Q_EMIT contactsAdded(contacts);
+    }
+}
+
+void AllContactsMonitor::forwardContactChanged(const QString &contactId, const KABC::Addressee &contact)
+{
+    dropContactsSnapshot();
+    if (!d_ptr->m_emittingBatch) {
+        KABC::Addressee::Map contacts;
+        contacts.insert(contactId, contact);
+        Q_EMIT contactsChanged(contacts);
+    }
+}
+
+void AllContactsMonitor::forwardContactRemoved(const QString &contactId)
+{
+    dropContactsSnapshot();
+    if (!d_ptr->m_emittingBatch) {
+        Q_EMIT contactsRemoved(QStringList() << contactId);
+    }
+}
+
 
 
 #include "allcontactsmonitor.moc"
@@ -23,6 +23,7 @@
 #define ALLCONTACTSMONITOR_H
 
 #include <QObject>
+#include <QStringList>
 
 #include "kpeople_export.h"
 
@@ -32,6 +33,16 @@ namespace KPeople {
 
 class AllContactsMonitorPrivate;
 
+/**
+ * Receives the contacts of an AllContactsMonitor one at a time, see AllContactsMonitor::visitContacts()
+ */
+class KPEOPLE_EXPORT ContactVisitor
+{
+public:
+    virtual ~ContactVisitor();
+    virtual void visitContact(const QString &contactId, const KABC::Addressee &contact) = 0;
+};
+
 /**
  * This class should be subclassed by each datasource and return a list of
  * all contacts that the datasource knows about.
@@ -43,6 +54,12 @@ class KPEOPLE_EXPORT AllContactsMonitor : public QObject
 {
     Q_OBJECT
 public:
+    enum LoadState {
+        InitialLoad, ///< the initial fetch is still running
+        Loaded,      ///< all contacts have been fetched
+        LoadFailed   ///< the initial fetch failed, the contacts might be incomplete
+    };
+
     explicit AllContactsMonitor(); //TODO make protected? this isn't useful unless subclassed
     virtual ~AllContactsMonitor();
 
@@ -51,9 +68,47 @@ public:
      */
     virtual KABC::Addressee::Map contacts();
 
-    //TODO redo as a state enum - InitialLoad, Fail, Loaded
+    /**
+     * Returns the contact with the ID @p contactId, or an empty contact if it isn't loaded
+     *
+     * Subclasses should reimplement this and the following methods so reading a few
+     * contacts doesn't need a copy of all of them. The default implementations use contacts(),
+     * which they call on every lookup during the initial load, and afterwards only again
+     * after one of the change signals was emitted.
+     */
+    virtual KABC::Addressee contact(const QString &contactId);
+
+    /**
+     * Returns whether the contact with the ID @p contactId is loaded
+     */
+    virtual bool contains(const QString &contactId);
+
+    /**
+     * Returns the number of loaded contacts
+     */
+    virtual int count();
+
+    /**
+     * Calls @p visitor once for every loaded contact
+     */
+    virtual void visitContacts(ContactVisitor &visitor);
+
+    LoadState loadState() const;
+
+    /**
+     * The number of contacts fetched so far during the initial load
+     */
+    int loadedCount() const;
+
+    /**
+     * The number of contacts the initial load is expected to fetch, -1 if the DataSource doesn't know
+     */
+    int expectedCount() const;
+
+    /** Same as loadState() != InitialLoad */
     bool isInitialFetchComplete() const;
-    
+
+    /** Same as loadState() == Loaded */
     bool initialFetchSuccess() const;
 
 Q_SIGNALS:
@@ -72,6 +127,25 @@ Q_SIGNALS:
      */
     void contactRemoved(const QString &contactId);
 
+    /**
+     * Emitted with all contacts added at once, i.e. during the initial fetch.
+     *
+     * The per-contact signals are emitted as well, so DataSources only need to emit one of them.
+     * Contacts announced through contactAdded() alone are also announced here, one at a time.
+     * The same applies to contactsChanged() and contactsRemoved().
+     */
+    void contactsAdded(const KABC::Addressee::Map &contacts);
+
+    /**
+     * Emitted with all contacts changed at once
+     */
+    void contactsChanged(const KABC::Addressee::Map &contacts);
+
+    /**
+     * Emitted with all contacts removed at once
+     */
+    void contactsRemoved(const QStringList &contactIds);
+
     /**
      * Notifies that the DataSource has completed it's initial fetch.
      *
@@ -82,6 +156,14 @@ Q_SIGNALS:
      */
     void initialFetchComplete( bool success );
 
+    /**
+     * Emitted while the initial fetch runs, see setLoadProgress()
+     *
+     * @param loaded the number of contacts fetched so far
+     * @param expected the number of contacts expected in total, -1 if unknown
+     */
+    void loadProgress(int loaded, int expected);
+
 protected Q_SLOTS:
     /**
      * DataSources should call this once they have finished initial retrieval of all contacts from their
@@ -93,7 +175,34 @@ protected Q_SLOTS:
      */
     void emitInitialFetchComplete( bool success );
 
+    /**
+     * DataSources can call this during their initial fetch to report how far along they are.
+     * Pass -1 as @p expected if the total isn't known.
+     *
+     * This will emit loadProgress()
+     */
+    void setLoadProgress(int loaded, int expected);
+
+    /**
+     * DataSources should call these to announce many contacts at once.
+     * They emit the batch signal followed by the per-contact signal for every contact.
+     */
+    void emitContactsAdded(const KABC::Addressee::Map &contacts);
+    void emitContactsChanged(const KABC::Addressee::Map &contacts);
+    void emitContactsRemoved(const QStringList &contactIds);
+
+private Q_SLOTS:
+    //turn contacts emitted one at a time into batches of one
+    void forwardContactAdded(const QString &contactId, const KABC::Addressee &contact);
+    void forwardContactChanged(const QString &contactId, const KABC::Addressee &contact);
+    void forwardContactRemoved(const QString &contactId);
+
+    //the contacts changed, the default lookups have to call contacts() again
+    void dropContactsSnapshot();
+
 private:
+    const KABC::Addressee::Map& contactsSnapshot();
+
     Q_DISABLE_COPY(AllContactsMonitor)
     Q_DECLARE_PRIVATE(AllContactsMonitor)
     AllContactsMonitorPrivate *d_ptr;
@@ -46,11 +46,7 @@ void FakeContactSource::changeContact1Email()
 
 FakeAllContactsMonitor::FakeAllContactsMonitor()
 {
-}
-
-KABC::Addressee::Map FakeAllContactsMonitor::contacts()
-{
-    KABC::Addressee::Map contacts;
+    KABC::Addressee::Map &contacts = m_contacts;
 
     {
         KABC::Addressee contact1;
@@ -72,16 +68,41 @@ KABC::Addressee::Map FakeAllContactsMonitor::contacts()
         contact3.setEmails(QStringList() << "contact3@example.com");
         contacts["fakesource://contact3"] = contact3;
     }
+}
 
-    return contacts;
+KABC::Addressee::Map FakeAllContactsMonitor::contacts()
+{
+    return m_contacts;
 }
 
 void FakeAllContactsMonitor::changeContact1Email()
 {
-    KABC::Addressee contact1 = contacts()["fakesource://contact1"];
+    KABC::Addressee &contact1 = m_contacts["fakesource://contact1"];
     contact1.setEmails(QStringList() << "newaddress@yahoo.com");
 
     Q_EMIT contactChanged("fakesource://contact1", contact1);
 }
 
+void FakeAllContactsMonitor::addContacts(const KABC::Addressee::Map &contacts)
+{
+    m_contacts.unite(contacts);
+    emitContactsAdded(contacts);
+}
+
+//like a source which only announces the end of its initial fetch
+void FakeAllContactsMonitor::addContactQuietly(const QString &contactId, const KABC::Addressee &contact)
+{
+    m_contacts.insert(contactId, contact);
+}
+
+void FakeAllContactsMonitor::setProgress(int loaded, int expected)
+{
+    setLoadProgress(loaded, expected);
+}
+
+void FakeAllContactsMonitor::finishLoading()
+{
+    emitInitialFetchComplete(true);
+}
+
 #include "fakecontactsource.moc"
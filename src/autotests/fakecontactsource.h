@@ -42,7 +42,13 @@ class FakeAllContactsMonitor : public KPeople::AllContactsMonitor
 public:
     explicit FakeAllContactsMonitor();
     void changeContact1Email();
+    void addContacts(const KABC::Addressee::Map &contacts);
+    void addContactQuietly(const QString &contactId, const KABC::Addressee &contact);
+    void setProgress(int loaded, int expected);
+    void finishLoading();
     virtual KABC::Addressee::Map contacts();
+private:
+    KABC::Addressee::Map m_contacts;
 };
 
 #endif // FAKECONTACTSOURCE_H
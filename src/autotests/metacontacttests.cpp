@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2013  David Edmundson <davidedmundson@kde.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "metacontacttests.h"
+
+#include <QtTest>
+
+//private includes
+#include "metacontact_p.h"
+
+QTEST_MAIN(MetaContactTests);
+
+using namespace KPeople;
+
+static KABC::Addressee makeContact(const QString &name, const QString &email)
+{
+    KABC::Addressee contact;
+    contact.setName(name);
+    contact.insertEmail(email);
+    return contact;
+}
+
+void MetaContactTests::singleContact()
+{
+    const KABC::Addressee contact1 = makeContact("Contact 1", "contact1@example.com");
+    MetaContact mc("fakesource://contact1", contact1);
+
+    QVERIFY(mc.isValid());
+    QCOMPARE(mc.id(), QString("fakesource://contact1"));
+    QCOMPARE(mc.contactCount(), 1);
+    QCOMPARE(mc.contactIds(), QStringList() << "fakesource://contact1");
+    QCOMPARE(mc.indexOfContact("fakesource://contact1"), 0);
+    QCOMPARE(mc.indexOfContact("fakesource://contact2"), -1);
+    QCOMPARE(mc.contactAt(0), contact1);
+    QVERIFY(mc.contactAt(1).isEmpty());
+    QCOMPARE(mc.contacts().size(), 1);
+
+    //the contact is its own person
+    QCOMPARE(mc.personAddressee(), contact1);
+}
+
+void MetaContactTests::insertSecondContact()
+{
+    const KABC::Addressee contact1 = makeContact("Contact 1", "contact1@example.com");
+    const KABC::Addressee contact2 = makeContact("Contact 2", "contact2@example.com");
+    MetaContact mc("fakesource://contact1", contact1);
+
+    QCOMPARE(mc.insertContact("fakesource://contact2", contact2), 1);
+    QCOMPARE(mc.contactCount(), 2);
+    QCOMPARE(mc.contactIds(), QStringList() << "fakesource://contact1" << "fakesource://contact2");
+    QCOMPARE(mc.indexOfContact("fakesource://contact2"), 1);
+    QCOMPARE(mc.contactAt(0), contact1);
+    QCOMPARE(mc.contactAt(1), contact2);
+
+    //the person is built from both, the first contact wins for single values
+    QCOMPARE(mc.personAddressee().name(), QString("Contact 1"));
+    QCOMPARE(mc.personAddressee().emails(), QStringList() << "contact1@example.com" << "contact2@example.com");
+}
+
+void MetaContactTests::insertDuplicateContact()
+{
+    MetaContact mc("fakesource://contact1", makeContact("Contact 1", "contact1@example.com"));
+    QCOMPARE(mc.insertContact("fakesource://contact1", makeContact("Other", "other@example.com")), -1);
+    QCOMPARE(mc.contactCount(), 1);
+    QCOMPARE(mc.personAddressee().name(), QString("Contact 1"));
+}
+
+void MetaContactTests::removeBackToOneContact()
+{
+    const KABC::Addressee contact1 = makeContact("Contact 1", "contact1@example.com");
+    const KABC::Addressee contact2 = makeContact("Contact 2", "contact2@example.com");
+    const KABC::Addressee contact3 = makeContact("Contact 3", "contact3@example.com");
+    KABC::Addressee::Map contacts;
+    contacts.insert("fakesource://contact1", contact1);
+    contacts.insert("fakesource://contact2", contact2);
+    MetaContact mc("kpeople://1", contacts);
+
+    //the remaining contact is the whole person again
+    QCOMPARE(mc.removeContact("fakesource://contact1"), 0);
+    QCOMPARE(mc.contactCount(), 1);
+    QCOMPARE(mc.contactIds(), QStringList() << "fakesource://contact2");
+    QCOMPARE(mc.indexOfContact("fakesource://contact2"), 0);
+    QCOMPARE(mc.contactAt(0), contact2);
+    QCOMPARE(mc.personAddressee(), contact2);
+
+    //and grows again from there
+    QCOMPARE(mc.insertContact("fakesource://contact3", contact3), 1);
+    QCOMPARE(mc.contactIds(), QStringList() << "fakesource://contact2" << "fakesource://contact3");
+    QCOMPARE(mc.personAddressee().emails(), QStringList() << "contact2@example.com" << "contact3@example.com");
+}
+
+void MetaContactTests::removeLastContact()
+{
+    MetaContact mc("fakesource://contact1", makeContact("Contact 1", "contact1@example.com"));
+
+    QCOMPARE(mc.removeContact("fakesource://contact1"), 0);
+    QVERIFY(!mc.isValid());
+    QCOMPARE(mc.contactCount(), 0);
+    QVERIFY(mc.contactIds().isEmpty());
+    QVERIFY(mc.contacts().isEmpty());
+    QVERIFY(mc.personAddressee().isEmpty());
+    QCOMPARE(mc.removeContact("fakesource://contact1"), -1);
+
+    //an empty person takes a new first contact
+    const KABC::Addressee contact2 = makeContact("Contact 2", "contact2@example.com");
+    QCOMPARE(mc.insertContact("fakesource://contact2", contact2), 0);
+    QCOMPARE(mc.personAddressee(), contact2);
+}
+
+void MetaContactTests::updateSingleContact()
+{
+    MetaContact mc("fakesource://contact1", makeContact("Contact 1", "contact1@example.com"));
+    const MetaContact copy = mc;
+
+    const KABC::Addressee changed = makeContact("Contact 1", "changed@example.com");
+    QCOMPARE(mc.updateContact("fakesource://contact1", changed), 0);
+    QCOMPARE(mc.contactCount(), 1);
+    QCOMPARE(mc.contactAt(0), changed);
+    QCOMPARE(mc.personAddressee(), changed);
+    QCOMPARE(mc.updateContact("fakesource://missing", changed), -1);
+
+    //copies keep what they had
+    QCOMPARE(copy.personAddressee().emails(), QStringList() << "contact1@example.com");
+}
+
+void MetaContactTests::updateMergedContact()
+{
+    KABC::Addressee::Map contacts;
+    contacts.insert("fakesource://contact1", makeContact("Contact 1", "contact1@example.com"));
+    contacts.insert("fakesource://contact2", makeContact("Contact 2", "contact2@example.com"));
+    MetaContact mc("kpeople://1", contacts);
+    const MetaContact copy = mc;
+
+    const KABC::Addressee changed = makeContact("Contact 2", "changed@example.com");
+    QCOMPARE(mc.updateContact("fakesource://contact2", changed), 1);
+    QCOMPARE(mc.contactCount(), 2);
+    QCOMPARE(mc.contactAt(1), changed);
+    QCOMPARE(mc.personAddressee().emails(), QStringList() << "contact1@example.com" << "changed@example.com");
+
+    //copies keep what they had
+    QCOMPARE(copy.contactAt(1).emails(), QStringList() << "contact2@example.com");
+    QCOMPARE(copy.personAddressee().emails(), QStringList() << "contact1@example.com" << "contact2@example.com");
+}
+
+#include "metacontacttests.moc"
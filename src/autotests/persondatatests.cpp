@@ -21,6 +21,7 @@
 
 #include <QtTest>
 #include <QFile>
+#include <QAction>
 
 //private includes
 #include "personmanager_p.h"
@@ -28,6 +29,9 @@
 
 //public kpeople includes
 #include <persondata.h>
+#include <global.h>
+#include <abstractpersonaction.h>
+#include <personsmodel.h>
 
 #include "fakecontactsource.h"
 
@@ -43,6 +47,21 @@ QTEST_MAIN(PersonDataTests);
 
 using namespace KPeople;
 
+//an action plugin with one action per person, named after the person
+class FakePersonAction : public AbstractPersonAction
+{
+public:
+    FakePersonAction() : AbstractPersonAction(0) {}
+
+    virtual QList<QAction*> actionsForPerson(const KABC::Addressee &person,
+                                             const KABC::AddresseeList &contacts,
+                                             QObject *parent) const
+    {
+        Q_UNUSED(contacts);
+        return QList<QAction*>() << new QAction(person.formattedName(), parent);
+    }
+};
+
 //this tests PersonData but also implicitly tests the private classes
 // - BasePersonsDataSource
 // - DefaultContactMonitor
@@ -116,4 +135,220 @@ void PersonDataTests::contactChanged()
     QCOMPARE(person.person().emails().first(), QString("newaddress@yahoo.com"));
 }
 
+void PersonDataTests::contactChangedOnlyReachesItsWatchers()
+{
+    PersonData person1("fakesource://contact1");
+    PersonData person2("fakesource://contact2");
+
+    QSignalSpy spy1(&person1, SIGNAL(dataChanged()));
+    QSignalSpy spy2(&person2, SIGNAL(dataChanged()));
+    m_source->changeContact1Email();
+
+    QCOMPARE(spy1.count(), 1);
+    QCOMPARE(spy2.count(), 0);
+}
+
+//collects the IDs of all visited contacts
+class ContactIdCollector : public ContactVisitor
+{
+public:
+    virtual void visitContact(const QString &contactId, const KABC::Addressee &contact)
+    {
+        Q_UNUSED(contact);
+        contactIds << contactId;
+    }
+    QStringList contactIds;
+};
+
+void PersonDataTests::contactLookups()
+{
+    //the fake monitor only implements contacts(), this goes through the default lookups
+    const AllContactsMonitorPtr monitor = m_source->allContactsMonitor();
+
+    QCOMPARE(monitor->count(), 3);
+    QVERIFY(monitor->contains("fakesource://contact2"));
+    QVERIFY(!monitor->contains("fakesource://missing"));
+    QCOMPARE(monitor->contact("fakesource://contact2").name(), QString("Person A"));
+    QVERIFY(monitor->contact("fakesource://missing").isEmpty());
+
+    ContactIdCollector collector;
+    monitor->visitContacts(collector);
+    QCOMPARE(collector.contactIds.toSet(), QSet<QString>() << "fakesource://contact1" << "fakesource://contact2" << "fakesource://contact3");
+
+    //a change is seen by the next lookup
+    m_source->changeContact1Email();
+    QCOMPARE(monitor->contact("fakesource://contact1").emails(), QStringList() << "newaddress@yahoo.com");
+}
+
+void PersonDataTests::contactLookupsWhileLoading()
+{
+    FakeAllContactsMonitor monitor;
+    QCOMPARE(monitor.count(), 3);
+
+    //contacts filled in without a signal before the load finishes are found
+    KABC::Addressee contact4;
+    contact4.setName("Contact 4");
+    monitor.addContactQuietly("fakesource://contact4", contact4);
+    QCOMPARE(monitor.count(), 4);
+    QVERIFY(monitor.contains("fakesource://contact4"));
+
+    monitor.addContactQuietly("fakesource://contact5", KABC::Addressee());
+    monitor.finishLoading();
+    QCOMPARE(monitor.count(), 5);
+}
+
+void PersonDataTests::contactsAddedBatch()
+{
+    FakeAllContactsMonitor monitor;
+    QSignalSpy batchSpy(&monitor, SIGNAL(contactsAdded(KABC::Addressee::Map)));
+    QSignalSpy contactSpy(&monitor, SIGNAL(contactAdded(QString,KABC::Addressee)));
+
+    KABC::Addressee::Map contacts;
+    contacts["fakesource://contact4"].setName("Contact 4");
+    contacts["fakesource://contact5"].setName("Contact 5");
+    monitor.addContacts(contacts);
+
+    //one batch with both contacts, the single contact signals aren't forwarded as batches again
+    QCOMPARE(batchSpy.count(), 1);
+    QCOMPARE(contactSpy.count(), 2);
+    QCOMPARE(contactSpy.at(0).first().toString(), QString("fakesource://contact4"));
+    QCOMPARE(contactSpy.at(1).first().toString(), QString("fakesource://contact5"));
+    QCOMPARE(monitor.count(), 5);
+}
+
+void PersonDataTests::modelLoadProgress()
+{
+    PersonsModel model;
+    FakeAllContactsMonitor *monitor = qobject_cast<FakeAllContactsMonitor*>(m_source->allContactsMonitor().data());
+    QVERIFY(monitor);
+    QSignalSpy spy(&model, SIGNAL(loadProgress(int,int)));
+
+    //the total stays unknown while the source doesn't know it
+    monitor->setProgress(1, -1);
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.last().at(0).toInt(), 1);
+    QCOMPARE(spy.last().at(1).toInt(), -1);
+    QCOMPARE(model.expectedContactsCount(), -1);
+
+    monitor->setProgress(2, 3);
+    QCOMPARE(spy.last().at(0).toInt(), 2);
+    QCOMPARE(spy.last().at(1).toInt(), 3);
+
+    //once finished the source counts with all its contacts, not its last reported progress
+    monitor->finishLoading();
+    QCOMPARE(spy.last().at(0).toInt(), 3);
+    QCOMPARE(spy.last().at(1).toInt(), 3);
+    QCOMPARE(model.loadedContactsCount(), 3);
+    QCOMPARE(model.expectedContactsCount(), 3);
+}
+
+void PersonDataTests::modelMergeAndUnmerge()
+{
+    qRegisterMetaType<QModelIndex>("QModelIndex");
+
+    PersonsModel model;
+    FakeAllContactsMonitor *monitor = qobject_cast<FakeAllContactsMonitor*>(m_source->allContactsMonitor().data());
+    QVERIFY(monitor);
+
+    KABC::Addressee::Map contacts;
+    for (int i = 1; i <= 5; i++) {
+        contacts[QString("fakesource://merge%1").arg(i)].setName(QString("Merge %1").arg(i));
+    }
+    monitor->addContacts(contacts);
+    const int rowCount = model.rowCount();
+
+    QSignalSpy removedSpy(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    QSignalSpy insertedSpy(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+
+    //merging persons of their own drops their adjacent rows at once and adds the new person
+    const QString personId = PersonManager::instance()->mergeContacts(QStringList() << "fakesource://merge1" << "fakesource://merge2" << "fakesource://merge3");
+    QVERIFY(!personId.isEmpty());
+    QCOMPARE(removedSpy.count(), 1);
+    QVERIFY(!removedSpy.first().at(0).value<QModelIndex>().isValid());
+    QCOMPARE(removedSpy.first().at(1).toInt(), rowCount - 5);
+    QCOMPARE(removedSpy.first().at(2).toInt(), rowCount - 3);
+    QCOMPARE(insertedSpy.count(), 1);
+    QVERIFY(!insertedSpy.first().at(0).value<QModelIndex>().isValid());
+    QCOMPARE(model.rowCount(), rowCount - 2);
+    QCOMPARE(model.rowCount(model.index(rowCount - 3)), 3);
+
+    //contacts moving into an existing person are inserted below it in one range
+    removedSpy.clear();
+    insertedSpy.clear();
+    QCOMPARE(PersonManager::instance()->mergeContacts(QStringList() << personId << "fakesource://merge4" << "fakesource://merge5"), personId);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(removedSpy.first().at(1).toInt(), rowCount - 5);
+    QCOMPARE(removedSpy.first().at(2).toInt(), rowCount - 4);
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(insertedSpy.first().at(0).value<QModelIndex>().row(), rowCount - 5);
+    QCOMPARE(insertedSpy.first().at(1).toInt(), 3);
+    QCOMPARE(insertedSpy.first().at(2).toInt(), 4);
+    QCOMPARE(model.rowCount(), rowCount - 4);
+    QCOMPARE(model.rowCount(model.index(rowCount - 5)), 5);
+
+    //unmerging drops the person's row and brings all its contacts back together
+    removedSpy.clear();
+    insertedSpy.clear();
+    QVERIFY(PersonManager::instance()->unmergeContact(personId));
+    QCOMPARE(removedSpy.count(), 1);
+    QVERIFY(!removedSpy.first().at(0).value<QModelIndex>().isValid());
+    QCOMPARE(removedSpy.first().at(1).toInt(), rowCount - 5);
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(insertedSpy.first().at(1).toInt(), rowCount - 5);
+    QCOMPARE(insertedSpy.first().at(2).toInt(), rowCount - 1);
+    QCOMPARE(model.rowCount(), rowCount);
+}
+
+void PersonDataTests::pluginLoadTimings()
+{
+    const int timingCount = PersonPluginManager::pluginLoadTimings().size();
+    PersonPluginManager::queryServices(QLatin1String("KPeople/DataSource"));
+
+    //a query is recorded on its own, without a plugin
+    const QList<PluginLoadTiming> timings = PersonPluginManager::pluginLoadTimings();
+    QCOMPARE(timings.size(), timingCount + 1);
+    QCOMPARE(timings.last().serviceType, QString("KPeople/DataSource"));
+    QVERIFY(timings.last().plugin.isEmpty());
+    QVERIFY(timings.last().loaded);
+    QVERIFY(timings.last().queryTime >= 0);
+    QCOMPARE(timings.last().libraryLoadTime, qint64(0));
+    QCOMPARE(timings.last().constructorTime, qint64(0));
+}
+
+void PersonDataTests::cachedActions()
+{
+    PersonPluginManager::setActionPlugins(QList<AbstractPersonAction*>() << new FakePersonAction);
+
+    KABC::Addressee person;
+    person.setUid("kpeople://1");
+    person.setFormattedName("Person");
+    person.insertEmail("person@example.com");
+
+    const QList<QAction*> actions = KPeople::cachedActionsForPerson("kpeople://1", person, KABC::AddresseeList());
+    QCOMPARE(actions.size(), 1);
+    QCOMPARE(actions.first()->text(), QString("Person"));
+
+    //nothing changed, the same actions
+    QCOMPARE(KPeople::cachedActionsForPerson("kpeople://1", person, KABC::AddresseeList()), actions);
+
+    //another person doesn't get them
+    KABC::Addressee otherPerson = person;
+    otherPerson.setUid("kpeople://2");
+    otherPerson.setFormattedName("Other Person");
+    const QList<QAction*> otherActions = KPeople::cachedActionsForPerson("kpeople://2", otherPerson, KABC::AddresseeList());
+    QCOMPARE(otherActions.first()->text(), QString("Other Person"));
+
+    //a changed detail builds them again, the old ones stay valid until the event loop runs
+    QPointer<QAction> oldAction = actions.first();
+    person.insertEmail("second@example.com");
+    const QList<QAction*> newActions = KPeople::cachedActionsForPerson("kpeople://1", person, KABC::AddresseeList());
+    QCOMPARE(newActions.size(), 1);
+    QVERIFY(newActions.first() != oldAction.data());
+    QVERIFY(oldAction);
+    QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+    QVERIFY(!oldAction);
+
+    PersonPluginManager::setActionPlugins(QList<AbstractPersonAction*>());
+}
+
 #include "persondatatests.moc"
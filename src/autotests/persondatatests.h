@@ -37,6 +37,14 @@ private slots:
     void loadContact();
     void loadPerson();
     void contactChanged();
+    void contactChangedOnlyReachesItsWatchers();
+    void contactLookups();
+    void contactLookupsWhileLoading();
+    void contactsAddedBatch();
+    void modelLoadProgress();
+    void modelMergeAndUnmerge();
+    void pluginLoadTimings();
+    void cachedActions();
 private:
     FakeContactSource *m_source;
 };
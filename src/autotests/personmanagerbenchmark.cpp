@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2013  David Edmundson <davidedmundson@kde.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "personmanagerbenchmark.h"
+
+#include <QtTest>
+
+#include <KTempDir>
+
+//private includes
+#include "personmanager_p.h"
+
+QTEST_MAIN(PersonManagerBenchmark);
+
+//number of persons in the database during the lookup benchmarks, each with two contacts
+static const int s_personCount = 1000;
+
+void PersonManagerBenchmark::initTestCase()
+{
+    //the database and its snapshot are removed along with the directory
+    m_tempDir = new KTempDir();
+    PersonManager::instance(m_tempDir->name() + QLatin1String("persondb"));
+
+    for (int i = 0; i < s_personCount; i++) {
+        const QString contactA = QString("fakesource://contact%1a").arg(i);
+        const QString contactB = QString("fakesource://contact%1b").arg(i);
+        m_personIds << PersonManager::instance()->mergeContacts(QStringList() << contactA << contactB);
+        m_contactIds << contactA << contactB;
+    }
+}
+
+void PersonManagerBenchmark::cleanupTestCase()
+{
+    delete m_tempDir;
+}
+
+void PersonManagerBenchmark::mergeContacts()
+{
+    int i = 0;
+    QBENCHMARK {
+        PersonManager::instance()->mergeContacts(QStringList() << QString("fakesource://merge%1a").arg(i)
+                                                               << QString("fakesource://merge%1b").arg(i));
+        i++;
+    }
+}
+
+void PersonManagerBenchmark::mergeContactsBatch()
+{
+    //the size of a typical dedup run
+    const int groupCount = 10000;
+
+    int run = 0;
+    QBENCHMARK {
+        QList<QStringList> groups;
+        groups.reserve(groupCount);
+        for (int i = 0; i < groupCount; i++) {
+            groups << (QStringList() << QString("fakesource://batch%1-%2a").arg(run).arg(i)
+                                     << QString("fakesource://batch%1-%2b").arg(run).arg(i));
+        }
+        const QStringList personIds = PersonManager::instance()->mergeContactsBatch(groups);
+        QCOMPARE(personIds.size(), groupCount);
+        QVERIFY(!personIds.contains(QString()));
+        run++;
+    }
+}
+
+void PersonManagerBenchmark::personIdForContact()
+{
+    QBENCHMARK {
+        Q_FOREACH(const QString &contactId, m_contactIds) {
+            PersonManager::instance()->personIdForContact(contactId);
+        }
+    }
+}
+
+void PersonManagerBenchmark::contactsForPersonId()
+{
+    QBENCHMARK {
+        Q_FOREACH(const QString &personId, m_personIds) {
+            PersonManager::instance()->contactsForPersonId(personId);
+        }
+    }
+}
+
+#include "personmanagerbenchmark.moc"
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2013  David Edmundson <davidedmundson@kde.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+//Merges contacts from several processes at once into the same database and reports
+//the throughput and how often writers had to wait for each other.
+//
+//usage: personmanagerstress [processes] [merges per process]
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QProcess>
+#include <QStringList>
+#include <QTextStream>
+#include <QFile>
+
+//private includes
+#include "personmanager_p.h"
+
+static const char *s_databasePath = "/tmp/kpeople_stress_db";
+
+static int runWorker(int worker, int merges)
+{
+    PersonManager *manager = PersonManager::instance(QLatin1String(s_databasePath));
+
+    int failed = 0;
+    for (int i = 0; i < merges; i++) {
+        const QString personId = manager->mergeContacts(QStringList() << QString("fakesource://stress%1-%2a").arg(worker).arg(i)
+                                                                      << QString("fakesource://stress%1-%2b").arg(worker).arg(i));
+        if (personId.isEmpty()) {
+            failed++;
+        }
+    }
+
+    //read by the parent process
+    QTextStream(stdout) << failed << ' ' << PersonManager::writeConflicts() << endl;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+
+    if (args.size() == 4 && args[1] == QLatin1String("--worker")) {
+        return runWorker(args[2].toInt(), args[3].toInt());
+    }
+
+    const int processCount = args.size() > 1 ? args[1].toInt() : 4;
+    const int mergesPerProcess = args.size() > 2 ? args[2].toInt() : 500;
+
+    QFile::remove(QLatin1String(s_databasePath));
+    QFile::remove(QLatin1String(s_databasePath) + "-wal");
+    QFile::remove(QLatin1String(s_databasePath) + "-shm");
+    //create the schema before the workers race for it
+    PersonManager::instance(QLatin1String(s_databasePath));
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QList<QProcess*> workers;
+    for (int i = 0; i < processCount; i++) {
+        QProcess *worker = new QProcess(&app);
+        worker->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        worker->start(args[0], QStringList() << "--worker" << QString::number(i) << QString::number(mergesPerProcess));
+        workers << worker;
+    }
+
+    int failed = 0;
+    int conflicts = 0;
+    Q_FOREACH (QProcess *worker, workers) {
+        worker->waitForFinished(-1);
+        const QStringList result = QString::fromLatin1(worker->readAllStandardOutput()).split(' ');
+        if (result.size() == 2) {
+            failed += result[0].toInt();
+            conflicts += result[1].toInt();
+        } else {
+            failed += mergesPerProcess;
+        }
+    }
+
+    const qint64 elapsed = qMax<qint64>(timer.elapsed(), 1);
+    const int total = processCount * mergesPerProcess;
+
+    //every successful merge must have ended up as its own person with both contacts
+    const QMultiHash<QString, QString> persons = PersonManager::instance()->allPersons();
+    const int personCount = persons.uniqueKeys().size();
+
+    QTextStream out(stdout);
+    out << processCount << " processes, " << total << " merges in " << elapsed << " ms" << endl;
+    out << "merges/s: " << (total - failed) * 1000.0 / elapsed << endl;
+    out << "failed merges: " << failed << endl;
+    out << "transactions waiting for the write lock: " << conflicts << " (" << conflicts * 100.0 / total << "% of merges)" << endl;
+    out << "persons: " << personCount << ", contacts: " << persons.size() << endl;
+
+    QFile::remove(QLatin1String(s_databasePath));
+
+    if (personCount != total - failed || persons.size() != 2 * personCount) {
+        out << "persondb is inconsistent" << endl;
+        return 1;
+    }
+    return 0;
+}
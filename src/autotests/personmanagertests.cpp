@@ -0,0 +1,368 @@
+/*
+ * Copyright (C) 2013  David Edmundson <davidedmundson@kde.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "personmanagertests.h"
+
+#include <QtTest>
+#include <QFile>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+
+#include <utime.h>
+
+//private includes
+#include "personmanager_p.h"
+#include "personsnapshot_p.h"
+
+QTEST_MAIN(PersonManagerTests);
+
+//a second instance on the test database, which has to find its lookups without the singleton's state
+class FreshPersonManager : public PersonManager
+{
+public:
+    FreshPersonManager() : PersonManager("/tmp/kpeople_manager_test_db") {}
+    virtual ~FreshPersonManager() {}
+};
+
+//the blocking writes replace the snapshot before they return, so it has the last one right away
+static bool snapshotHasLastWrite()
+{
+    PersonSnapshot snapshot("/tmp/kpeople_manager_test_db.snapshot");
+    return snapshot.map() && snapshot.sequence() == PersonManager::instance()->lastSequence();
+}
+
+void PersonManagerTests::initTestCase()
+{
+    QFile::remove("/tmp/kpeople_manager_test_db");
+    QFile::remove("/tmp/kpeople_manager_test_db.snapshot");
+    PersonManager::instance("/tmp/kpeople_manager_test_db");
+}
+
+void PersonManagerTests::cleanupTestCase()
+{
+    QFile::remove("/tmp/kpeople_manager_test_db");
+    QFile::remove("/tmp/kpeople_manager_test_db.snapshot");
+}
+
+void PersonManagerTests::journalMerge()
+{
+    const qint64 sequence = PersonManager::instance()->lastSequence();
+    const QString personId = PersonManager::instance()->mergeContacts(QStringList() << "fakesource://journal1" << "fakesource://journal2");
+    QVERIFY(!personId.isEmpty());
+
+    QList<PersonChange> changes;
+    QVERIFY(PersonManager::instance()->changesSince(sequence, changes));
+    QCOMPARE(changes.size(), 2);
+    QCOMPARE(changes[0].contactId, QString("fakesource://journal1"));
+    QCOMPARE(changes[0].personId, personId);
+    QCOMPARE(changes[1].contactId, QString("fakesource://journal2"));
+    QCOMPARE(changes[1].personId, personId);
+    QVERIFY(changes[0].sequence < changes[1].sequence);
+    QCOMPARE(changes[1].sequence, PersonManager::instance()->lastSequence());
+
+    //nothing happened since the last change
+    QVERIFY(PersonManager::instance()->changesSince(changes[1].sequence, changes));
+    QVERIFY(changes.isEmpty());
+}
+
+void PersonManagerTests::journalUnmerge()
+{
+    const QString personId = PersonManager::instance()->mergeContacts(QStringList() << "fakesource://journal3" << "fakesource://journal4");
+    const qint64 sequence = PersonManager::instance()->lastSequence();
+
+    PersonManager::instance()->unmergeContact("fakesource://journal3");
+
+    QList<PersonChange> changes;
+    QVERIFY(PersonManager::instance()->changesSince(sequence, changes));
+    QCOMPARE(changes.size(), 1);
+    QCOMPARE(changes[0].contactId, QString("fakesource://journal3"));
+    QVERIFY(changes[0].personId.isEmpty());
+    QCOMPARE(PersonManager::instance()->contactsForPersonId(personId), QStringList() << "fakesource://journal4");
+}
+
+void PersonManagerTests::journalCompaction()
+{
+    const qint64 sequence = PersonManager::instance()->lastSequence();
+
+    PersonManager::setJournalLimit(2);
+    PersonManager::instance()->mergeContacts(QStringList() << "fakesource://journal5" << "fakesource://journal6");
+    PersonManager::instance()->mergeContacts(QStringList() << "fakesource://journal7" << "fakesource://journal8");
+    PersonManager::setJournalLimit(10000);
+
+    //the changes after sequence are partly gone, the client has to start over
+    QList<PersonChange> changes;
+    QVERIFY(!PersonManager::instance()->changesSince(sequence, changes));
+
+    //the newest ones are still there
+    QVERIFY(PersonManager::instance()->changesSince(PersonManager::instance()->lastSequence() - 2, changes));
+    QCOMPARE(changes.size(), 2);
+    QCOMPARE(changes[0].contactId, QString("fakesource://journal7"));
+}
+
+//looks up all persons created by concurrentLookups() over and over, counting wrong answers
+class LookupRunnable : public QRunnable
+{
+public:
+    LookupRunnable(const QStringList &personIds, QAtomicInt *errors) :
+        m_personIds(personIds),
+        m_errors(errors)
+    {
+    }
+
+    virtual void run()
+    {
+        for (int round = 0; round < 20; round++) {
+            for (int i = 0; i < m_personIds.size(); i++) {
+                const QString contactA = QString("fakesource://thread%1a").arg(i);
+                const QString contactB = QString("fakesource://thread%1b").arg(i);
+
+                if (PersonManager::instance()->personIdForContact(contactA) != m_personIds[i]) {
+                    m_errors->ref();
+                }
+                if (PersonManager::instance()->contactsForPersonId(m_personIds[i]) != (QStringList() << contactA << contactB)) {
+                    m_errors->ref();
+                }
+            }
+
+            //this one goes to the database, on a connection of this thread
+            if (PersonManager::instance()->lastSequence() <= 0) {
+                m_errors->ref();
+            }
+        }
+    }
+
+private:
+    QStringList m_personIds;
+    QAtomicInt *m_errors;
+};
+
+void PersonManagerTests::concurrentLookups()
+{
+    QStringList personIds;
+    for (int i = 0; i < 100; i++) {
+        personIds << PersonManager::instance()->mergeContacts(QStringList() << QString("fakesource://thread%1a").arg(i)
+                                                                          << QString("fakesource://thread%1b").arg(i));
+    }
+
+    QAtomicInt errors(0);
+    QThreadPool pool;
+    pool.setMaxThreadCount(8);
+    for (int i = 0; i < 16; i++) {
+        pool.start(new LookupRunnable(personIds, &errors));
+    }
+    pool.waitForDone();
+
+    QCOMPARE(int(errors), 0);
+}
+
+void PersonManagerTests::queryStatistics()
+{
+    PersonManager::resetQueryStatistics();
+
+    PersonManager::instance()->mergeContacts(QStringList() << "fakesource://stats1" << "fakesource://stats2");
+    PersonManager::instance()->personIdForContact("fakesource://stats1");
+    PersonManager::instance()->personIdForContact("fakesource://stats2");
+
+    QCOMPARE(PersonManager::queryStatistics(PersonManager::MergeQuery).count, 1);
+    //only the write transaction of the merge, reading for the snapshot or the lookups doesn't count
+    QCOMPARE(PersonManager::queryStatistics(PersonManager::CommitQuery).count, 1);
+    QCOMPARE(PersonManager::queryStatistics(PersonManager::PersonIdForContactQuery).count, 2);
+    QCOMPARE(PersonManager::queryStatistics(PersonManager::UnmergeQuery).count, 0);
+
+    const PersonManager::QueryStatistics merge = PersonManager::queryStatistics(PersonManager::MergeQuery);
+    QVERIFY(merge.maxTime <= merge.totalTime);
+    //the commit is part of the merge
+    QVERIFY(PersonManager::queryStatistics(PersonManager::CommitQuery).totalTime <= merge.totalTime);
+}
+
+void PersonManagerTests::missedChanges()
+{
+    PersonManager::instance()->mergeContacts(QStringList() << "fakesource://gap1" << "fakesource://gap2");
+    const qint64 sequence = PersonManager::instance()->lastAppliedSequence();
+    QCOMPARE(sequence, PersonManager::instance()->lastSequence());
+
+    //another process writes two changes, we only get the signal of the second one
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "kpeople-test-writer");
+        db.setDatabaseName("/tmp/kpeople_manager_test_db");
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        query.prepare("INSERT INTO journal (contactId, personId) VALUES (?, ?)");
+        const QStringList contactIds = QStringList() << "fakesource://gap3" << "fakesource://gap4" << "fakesource://gap5";
+        const QList<int> personIds = QList<int>() << 9001 << 9001 << 9002;
+        for (int i = 0; i < contactIds.size(); i++) {
+            query.bindValue(0, contactIds[i]);
+            query.bindValue(1, personIds[i]);
+            QVERIFY(query.exec());
+        }
+    }
+    QSqlDatabase::removeDatabase("kpeople-test-writer");
+
+    QSignalSpy spy(PersonManager::instance(), SIGNAL(contactsAddedToPerson(QString,QStringList)));
+    QMetaObject::invokeMethod(PersonManager::instance(), "onContactsAddedToPerson",
+                              Q_ARG(QString, "kpeople://9002"), Q_ARG(QStringList, QStringList() << "fakesource://gap5"),
+                              Q_ARG(QString, ":1.test"), Q_ARG(qlonglong, sequence + 3));
+
+    //the missed change is replayed from the journal before the signalled one
+    QCOMPARE(spy.count(), 2);
+    QCOMPARE(spy[0][0].toString(), QString("kpeople://9001"));
+    QCOMPARE(spy[0][1].toStringList(), QStringList() << "fakesource://gap3" << "fakesource://gap4");
+    QCOMPARE(spy[1][0].toString(), QString("kpeople://9002"));
+    QCOMPARE(PersonManager::instance()->lastAppliedSequence(), sequence + 3);
+
+    //a late duplicate of a change already applied is ignored
+    QMetaObject::invokeMethod(PersonManager::instance(), "onContactsAddedToPerson",
+                              Q_ARG(QString, "kpeople://9002"), Q_ARG(QStringList, QStringList() << "fakesource://gap5"),
+                              Q_ARG(QString, ":1.test"), Q_ARG(qlonglong, sequence + 3));
+    QCOMPARE(spy.count(), 2);
+}
+
+void PersonManagerTests::snapshotRoundTrip()
+{
+    const QString fileName("/tmp/kpeople_manager_test_snapshot");
+    const QStringList contactIds = QStringList() << "fakesource://b" << "fakesource://a" << "fakesource://c";
+    const QVector<qint64> personIds = QVector<qint64>() << 2 << 1 << 2;
+    QVERIFY(PersonSnapshot::write(fileName, 42, contactIds, personIds));
+
+    PersonSnapshot snapshot(fileName);
+    QVERIFY(snapshot.map());
+    QCOMPARE(snapshot.sequence(), qint64(42));
+    QCOMPARE(snapshot.count(), 3);
+
+    QCOMPARE(snapshot.personIdForContact("fakesource://a"), qint64(1));
+    QCOMPARE(snapshot.personIdForContact("fakesource://b"), qint64(2));
+    QCOMPARE(snapshot.personIdForContact("fakesource://c"), qint64(2));
+    QCOMPARE(snapshot.personIdForContact("fakesource://missing"), qint64(-1));
+    QCOMPARE(snapshot.personIdForContact(QString()), qint64(-1));
+
+    //contacts of a person keep the order they were written in
+    QCOMPARE(snapshot.contactsForPersonId(1), QStringList() << "fakesource://a");
+    QCOMPARE(snapshot.contactsForPersonId(2), QStringList() << "fakesource://b" << "fakesource://c");
+    QVERIFY(snapshot.contactsForPersonId(0).isEmpty());
+    QVERIFY(snapshot.contactsForPersonId(3).isEmpty());
+
+    QCOMPARE(snapshot.personIdAt(0), qint64(1));
+    QCOMPARE(snapshot.contactIdAt(0), QString("fakesource://a"));
+    QCOMPARE(snapshot.personIdAt(2), qint64(2));
+    QCOMPARE(snapshot.contactIdAt(2), QString("fakesource://c"));
+
+    //the mapping stays valid after the file is replaced
+    QVERIFY(PersonSnapshot::write(fileName, 43, QStringList(), QVector<qint64>()));
+    QCOMPARE(snapshot.personIdForContact("fakesource://a"), qint64(1));
+    QVERIFY(snapshot.map());
+    QCOMPARE(snapshot.count(), 0);
+    QCOMPARE(snapshot.personIdForContact("fakesource://a"), qint64(-1));
+
+    snapshot.unmap();
+    QFile::remove(fileName);
+}
+
+void PersonManagerTests::snapshotInvalid_data()
+{
+    QTest::addColumn<int>("offset");
+    QTest::addColumn<QByteArray>("bytes");
+    QTest::addColumn<int>("size");
+
+    QTest::newRow("wrong magic") << 0 << QByteArray("XPEOPLES") << -1;
+    QTest::newRow("wrong version") << 8 << QByteArray("\xff\xff\xff\xff", 4) << -1;
+    QTest::newRow("truncated") << 0 << QByteArray() << 60;
+    QTest::newRow("header only") << 0 << QByteArray() << 20;
+    QTest::newRow("empty") << 0 << QByteArray() << 0;
+}
+
+void PersonManagerTests::snapshotInvalid()
+{
+    QFETCH(int, offset);
+    QFETCH(QByteArray, bytes);
+    QFETCH(int, size);
+
+    const QString personId = PersonManager::instance()->mergeContacts(QStringList() << "fakesource://corrupt1" << "fakesource://corrupt2");
+    QVERIFY(!personId.isEmpty());
+    QVERIFY(snapshotHasLastWrite());
+
+    //a valid snapshot of the wrong contents, damaged afterwards
+    const QString fileName("/tmp/kpeople_manager_test_db.snapshot");
+    QVERIFY(PersonSnapshot::write(fileName, PersonManager::instance()->lastSequence(),
+                                  QStringList() << "fakesource://corrupt1", QVector<qint64>() << 12345));
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    if (!bytes.isEmpty()) {
+        file.seek(offset);
+        file.write(bytes);
+    }
+    if (size >= 0) {
+        file.resize(size);
+    }
+    file.close();
+
+    PersonSnapshot snapshot(fileName);
+    QVERIFY(!snapshot.map());
+
+    //the lookups come from the database instead
+    FreshPersonManager manager;
+    QCOMPARE(manager.personIdForContact("fakesource://corrupt1"), personId);
+    QCOMPARE(manager.contactsForPersonId(personId), QStringList() << "fakesource://corrupt1" << "fakesource://corrupt2");
+
+    //and the broken snapshot was replaced
+    QVERIFY(snapshot.map());
+    QCOMPARE(QString("kpeople://%1").arg(snapshot.personIdForContact("fakesource://corrupt1")), personId);
+}
+
+void PersonManagerTests::snapshotStale()
+{
+    const QString personId = PersonManager::instance()->mergeContacts(QStringList() << "fakesource://stale1" << "fakesource://stale2");
+    QVERIFY(!personId.isEmpty());
+    QVERIFY(snapshotHasLastWrite());
+
+    //a snapshot written before the merge, by a writer which crashed before replacing it afterwards
+    const QString fileName("/tmp/kpeople_manager_test_db.snapshot");
+    QVERIFY(PersonSnapshot::write(fileName, PersonManager::instance()->lastSequence() - 2,
+                                  QStringList(), QVector<qint64>()));
+    struct utimbuf times;
+    times.actime = times.modtime = QDateTime::currentDateTime().addSecs(-3600).toTime_t();
+    QCOMPARE(utime(QFile::encodeName(fileName).constData(), &times), 0);
+
+    FreshPersonManager manager;
+    QCOMPARE(manager.personIdForContact("fakesource://stale1"), personId);
+    QCOMPARE(manager.lastAppliedSequence(), PersonManager::instance()->lastSequence());
+
+    //and the stale snapshot was replaced
+    PersonSnapshot snapshot(fileName);
+    QVERIFY(snapshot.map());
+    QCOMPARE(snapshot.sequence(), PersonManager::instance()->lastSequence());
+}
+
+void PersonManagerTests::snapshotWithoutDatabase()
+{
+    const QString personId = PersonManager::instance()->mergeContacts(QStringList() << "fakesource://mapped1" << "fakesource://mapped2");
+    QVERIFY(!personId.isEmpty());
+    QVERIFY(snapshotHasLastWrite());
+
+    FreshPersonManager manager;
+    QCOMPARE(manager.personIdForContact("fakesource://mapped1"), personId);
+    QCOMPARE(manager.contactsForPersonId(personId), QStringList() << "fakesource://mapped1" << "fakesource://mapped2");
+    QCOMPARE(manager.lastAppliedSequence(), PersonManager::instance()->lastSequence());
+
+    //the lookups came from the snapshot, the manager never opened its connection
+    QVERIFY(!QSqlDatabase::contains(QString("kpeople-%1").arg(quintptr(&manager), 0, 16)));
+}
+
+#include "personmanagertests.moc"
@@ -21,17 +21,139 @@
 #include "basepersonsdatasource.h"
 
 #include <QDebug>
+#include <QPointer>
+#include <QTimer>
 
 
 #include "defaultcontactmonitor_p.h"
 
 using namespace KPeople;
 
+//monitors are kept alive for a while after they were last requested, so a person which is
+//opened again right away doesn't need to be fetched again
+static const int s_pooledMonitorCount = 32;
+static const int s_pooledMonitorTimeout = 5000; //ms
+
+namespace {
+struct ContactMonitorPool;
+
+//keeps a monitor alive until its timer deletes it
+class PooledMonitor : public QObject
+{
+public:
+    PooledMonitor(ContactMonitorPool *pool, const QString &contactId, const ContactMonitorPtr &monitor);
+    virtual ~PooledMonitor();
+
+    //starts the timeout over
+    void keep();
+
+private:
+    ContactMonitorPool *m_pool;
+    QString m_contactId;
+    ContactMonitorPtr m_monitor;
+    QTimer m_expiry;
+};
+
+/*
+ * A ContactMonitor can't be wrapped in a new QSharedPointer once the last one is gone, so
+ * instead of taking monitors back after their users are done, the pool keeps a reference
+ * to every monitor for a few seconds after it was last requested.
+ */
+struct ContactMonitorPool
+{
+    ~ContactMonitorPool()
+    {
+        const QHash<QString, PooledMonitor*> pooled = pooledMonitors;
+        pooledMonitors.clear();
+        order.clear();
+        qDeleteAll(pooled);
+    }
+
+    void keep(const QString &contactId, const ContactMonitorPtr &monitor)
+    {
+        PooledMonitor *pooled = pooledMonitors.value(contactId);
+        if (pooled) {
+            order.removeOne(contactId);
+            pooled->keep();
+        } else {
+            pooledMonitors.insert(contactId, new PooledMonitor(this, contactId, monitor));
+        }
+        order.append(contactId);
+
+        if (order.size() > s_pooledMonitorCount) {
+            //removes itself
+            delete pooledMonitors.value(order.first());
+        }
+    }
+
+    //only holds monitors which are alive, ContactMonitorDeleter removes the others
+    QHash<QString, QWeakPointer<ContactMonitor> > monitors;
+    //the recently requested monitors, the oldest request first in order
+    QHash<QString, PooledMonitor*> pooledMonitors;
+    QStringList order;
+};
+
+PooledMonitor::PooledMonitor(ContactMonitorPool *pool, const QString &contactId, const ContactMonitorPtr &monitor):
+    m_pool(pool),
+    m_contactId(contactId),
+    m_monitor(monitor)
+{
+    m_expiry.setSingleShot(true);
+    connect(&m_expiry, SIGNAL(timeout()), SLOT(deleteLater()));
+    keep();
+}
+
+PooledMonitor::~PooledMonitor()
+{
+    m_pool->pooledMonitors.remove(m_contactId);
+    m_pool->order.removeOne(m_contactId);
+    //m_monitor goes away after this, which might delete the monitor
+}
+
+void PooledMonitor::keep()
+{
+    m_expiry.start(s_pooledMonitorTimeout);
+}
+
+//removes the monitor from the pool once its last reference is gone
+class ContactMonitorDeleter
+{
+public:
+    ContactMonitorDeleter(const QSharedPointer<ContactMonitorPool> &pool, const QString &contactId):
+        m_pool(pool),
+        m_contactId(contactId)
+    {}
+
+    void operator()(ContactMonitor *monitor) const
+    {
+        //the data source might be gone already
+        const QSharedPointer<ContactMonitorPool> pool = m_pool.toStrongRef();
+        if (pool) {
+            QHash<QString, QWeakPointer<ContactMonitor> >::iterator it = pool->monitors.find(m_contactId);
+            //unless it has been replaced by a new monitor in the meantime
+            if (it != pool->monitors.end() && it.value().isNull()) {
+                pool->monitors.erase(it);
+            }
+        }
+        delete monitor;
+    }
+private:
+    QWeakPointer<ContactMonitorPool> m_pool;
+    QString m_contactId;
+};
+}
+
 class KPeople::BasePersonsDataSourcePrivate
 {
 public:
+    BasePersonsDataSourcePrivate():
+        m_contactMonitors(new ContactMonitorPool)
+    {}
+
     QWeakPointer<AllContactsMonitor> m_allContactsMonitor;
-    QHash<QString, QWeakPointer<ContactMonitor> > m_contactMonitors;
+    QSharedPointer<ContactMonitorPool> m_contactMonitors;
+    //the dispatcher of the current m_allContactsMonitor, deleted along with it
+    QPointer<ContactMonitorDispatcher> m_dispatcher;
 };
 
 
@@ -65,15 +187,29 @@ ContactMonitorPtr BasePersonsDataSource::contactMonitor(const QString& contactId
 {
     Q_D(BasePersonsDataSource);
 
+    ContactMonitorPool *pool = d->m_contactMonitors.data();
     ContactMonitorPtr c;
-    if (!d->m_contactMonitors[contactId].toStrongRef()) {
-        c = ContactMonitorPtr(createContactMonitor(contactId));
-        d->m_contactMonitors[contactId] = c;
+    QHash<QString, QWeakPointer<ContactMonitor> >::const_iterator it = pool->monitors.constFind(contactId);
+    if (it != pool->monitors.constEnd()) {
+        c = it.value().toStrongRef();
+    }
+
+    if (!c) {
+        c = ContactMonitorPtr(createContactMonitor(contactId), ContactMonitorDeleter(d->m_contactMonitors, contactId));
+        pool->monitors.insert(contactId, c);
     }
-    return d->m_contactMonitors[contactId].toStrongRef();
+
+    pool->keep(contactId, c);
+    return c;
 }
 
 ContactMonitor* BasePersonsDataSource::createContactMonitor(const QString &contactId)
 {
-    return new DefaultContactMonitor(contactId, allContactsMonitor());
+    Q_D(BasePersonsDataSource);
+
+    const AllContactsMonitorPtr allContacts = allContactsMonitor();
+    if (!d->m_dispatcher) {
+        d->m_dispatcher = new ContactMonitorDispatcher(allContacts.data());
+    }
+    return new DefaultContactMonitor(contactId, allContacts, d->m_dispatcher);
 }
@@ -56,6 +56,9 @@ public:
     /**
      * Returns the ID used by this datasource.
      * i.e if the contactIDs are in the form akonadi://?item=324 this method should return "akonadi"
+     *
+     * Plugins should set the same value as X-KPeople-SourcePluginId in their desktop file,
+     * so they are only loaded when one of their contacts is used
      */
     virtual QString sourcePluginId() const = 0;
 
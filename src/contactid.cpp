@@ -0,0 +1,175 @@
+/*
+    Copyright (C) 2013  David Edmundson <davidedmundson@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "contactid_p.h"
+
+#include <QStringList>
+#include <QAtomicPointer>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <KGlobal>
+
+using namespace KPeople;
+
+namespace {
+//every source seen so far, by their index. A published table is never changed,
+//registerSource() publishes a copy, so readers don't need to lock anything
+struct SourceTable
+{
+    QStringList names;
+};
+
+struct SourceTables
+{
+    SourceTables()
+    {
+        SourceTable *table = new SourceTable;
+        table->names << QLatin1String("kpeople");
+        current = table;
+    }
+
+    ~SourceTables()
+    {
+        delete current.fetchAndAddAcquire(0);
+        qDeleteAll(retired);
+    }
+
+    QAtomicPointer<SourceTable> current;
+    //tables which have been replaced, readers might still be using them
+    QList<SourceTable*> retired;
+    //serializes registerSource(), never taken for reading
+    QMutex mutex;
+};
+}
+
+K_GLOBAL_STATIC(SourceTables, s_sources);
+
+static const QLatin1String s_separator("://");
+
+//the published table, with everything written to it before it was published visible
+static const SourceTable* currentSourceTable()
+{
+    //Qt 4 has no loadAcquire(), adding nothing is the same with acquire semantics
+    return s_sources->current.fetchAndAddAcquire(0);
+}
+
+ContactId::ContactId():
+    m_sourceIndex(NoSource),
+    m_localIdOffset(0)
+{
+}
+
+ContactId::ContactId(const QString &id):
+    m_id(id),
+    m_sourceIndex(NoSource),
+    m_localIdOffset(0)
+{
+    //there are only a few sources, match them in place instead of searching and copying the ID
+    const QStringList &names = currentSourceTable()->names;
+    for (int i = 0; i < names.size(); i++) {
+        const QString &source = names.at(i);
+        if (id.startsWith(source) && id.midRef(source.length(), 3) == s_separator) {
+            m_source = source;
+            m_sourceIndex = i;
+            m_localIdOffset = source.length() + 3;
+            return;
+        }
+    }
+
+    //a source no data source registered keeps a copy of its own
+    const int separator = id.indexOf(s_separator);
+    if (separator > 0) {
+        m_source = id.left(separator);
+        m_localIdOffset = separator + 3;
+    }
+}
+
+bool ContactId::isEmpty() const
+{
+    return m_id.isEmpty();
+}
+
+bool ContactId::isPerson() const
+{
+    return m_sourceIndex == PersonSource;
+}
+
+int ContactId::sourceIndex() const
+{
+    return m_sourceIndex;
+}
+
+QString ContactId::source() const
+{
+    return m_source;
+}
+
+QString ContactId::localId() const
+{
+    return m_id.mid(m_localIdOffset);
+}
+
+qint64 ContactId::personId() const
+{
+    if (!isPerson()) {
+        return -1;
+    }
+    return localId().toLongLong();
+}
+
+const QString& ContactId::toString() const
+{
+    return m_id;
+}
+
+int ContactId::indexOfSource(const QString &source)
+{
+    const int index = currentSourceTable()->names.indexOf(source);
+    return index < 0 ? NoSource : index;
+}
+
+int ContactId::registerSource(const QString &source)
+{
+    if (source.isEmpty()) {
+        return NoSource;
+    }
+    const int knownIndex = indexOfSource(source);
+    if (knownIndex != NoSource) {
+        return knownIndex;
+    }
+
+    QMutexLocker locker(&s_sources->mutex);
+    //someone could have added it in the meantime
+    const SourceTable *table = currentSourceTable();
+    const int index = table->names.indexOf(source);
+    if (index >= 0) {
+        return index;
+    }
+
+    SourceTable *newTable = new SourceTable(*table);
+    newTable->names << source;
+    //the old table is kept around, sources are only registered when a data source is loaded
+    s_sources->retired << s_sources->current.fetchAndStoreOrdered(newTable);
+    return newTable->names.size() - 1;
+}
+
+QString ContactId::sourceAt(int sourceIndex)
+{
+    return currentSourceTable()->names.value(sourceIndex);
+}
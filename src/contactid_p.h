@@ -0,0 +1,88 @@
+/*
+    Copyright (C) 2013  David Edmundson <davidedmundson@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef CONTACTID_H
+#define CONTACTID_H
+
+#include <QString>
+
+#include "kpeople_export.h"
+
+namespace KPeople
+{
+
+/**
+ * A contact or person ID split into the source it belongs to and the ID local to that source,
+ * i.e. akonadi://?item=15 is source "akonadi" with the local ID "?item=15".
+ *
+ * IDs are parsed once where they enter the library. Sources are interned into small
+ * integers, so routing a contact to its data source is an index lookup and
+ * doesn't need to look at the string again. Parsing and the lookups of interned
+ * sources don't lock anything.
+ */
+class KPEOPLE_EXPORT ContactId
+{
+public:
+    ContactId();
+    explicit ContactId(const QString &id);
+
+    enum {
+        /** The source index of person IDs (kpeople://) */
+        PersonSource = 0,
+        /** The source index of IDs without a source */
+        NoSource = -1
+    };
+
+    bool isEmpty() const;
+    bool isPerson() const;
+
+    /**
+     * The interned index of the source, NoSource if the ID has none or no data source
+     * registered it; source() still returns the latter
+     */
+    int sourceIndex() const;
+    QString source() const;
+    QString localId() const;
+
+    /** The number of a person ID, -1 for contacts */
+    qint64 personId() const;
+
+    const QString& toString() const;
+
+    /** The index @p source is interned as, NoSource if it wasn't registered */
+    static int indexOfSource(const QString &source);
+    static QString sourceAt(int sourceIndex);
+
+    /**
+     * Interns @p source, adding it if it wasn't used before.
+     * Only for the sources of loaded data sources, so that IDs coming from outside,
+     * i.e. over D-Bus, can't grow the table
+     */
+    static int registerSource(const QString &source);
+
+private:
+    QString m_id;
+    //shares the interned string, no copy of its own
+    QString m_source;
+    int m_sourceIndex;
+    int m_localIdOffset;
+};
+
+}
+
+#endif // CONTACTID_H
@@ -19,42 +19,82 @@
 
 #include "defaultcontactmonitor_p.h"
 
-DefaultContactMonitor::DefaultContactMonitor(const QString &contactId, const AllContactsMonitorPtr& allContactsWatcher):
-    ContactMonitor(contactId),
-    m_allContactsMonitor(allContactsWatcher)
+ContactMonitorDispatcher::ContactMonitorDispatcher(AllContactsMonitor *allContactsMonitor):
+    QObject(allContactsMonitor)
+{
+    connect(allContactsMonitor, SIGNAL(contactsAdded(KABC::Addressee::Map)), SLOT(onContactsAdded(KABC::Addressee::Map)));
+    connect(allContactsMonitor, SIGNAL(contactsRemoved(QStringList)), SLOT(onContactsRemoved(QStringList)));
+    connect(allContactsMonitor, SIGNAL(contactsChanged(KABC::Addressee::Map)), SLOT(onContactsChanged(KABC::Addressee::Map)));
+}
+
+void ContactMonitorDispatcher::addMonitor(DefaultContactMonitor *monitor)
 {
-    connect(allContactsWatcher.data(), SIGNAL(contactAdded(QString,KABC::Addressee)), SLOT(onContactAdded(QString,KABC::Addressee)));
-    connect(allContactsWatcher.data(), SIGNAL(contactRemoved(QString)), SLOT(onContactRemoved(QString)));
-    connect(allContactsWatcher.data(), SIGNAL(contactChanged(QString,KABC::Addressee)), SLOT(onContactChanged(QString,KABC::Addressee)));
+    m_monitors.insert(monitor->contactId(), monitor);
+}
 
-    const KABC::Addressee::Map &contacts = m_allContactsMonitor->contacts();
-    KABC::Addressee::Map::const_iterator it = contacts.constFind(contactId);
-    if (it != contacts.constEnd()) {
-        setContact(it.value());
+void ContactMonitorDispatcher::removeMonitor(DefaultContactMonitor *monitor)
+{
+    m_monitors.remove(monitor->contactId(), monitor);
+}
+
+void ContactMonitorDispatcher::dispatch(const QString &contactId, const KABC::Addressee &contact)
+{
+    //a copy, slots connected to contactChanged() might create or delete monitors;
+    //the deleted ones must not be called anymore
+    QList<QPointer<DefaultContactMonitor> > monitors;
+    Q_FOREACH(DefaultContactMonitor *monitor, m_monitors.values(contactId)) {
+        monitors << monitor;
+    }
+    Q_FOREACH(const QPointer<DefaultContactMonitor> &monitor, monitors) {
+        if (monitor) {
+            monitor->setContact(contact);
+        }
     }
 }
 
-void DefaultContactMonitor::onContactAdded(const QString& id, const KABC::Addressee& contact)
+void ContactMonitorDispatcher::onContactsAdded(const KABC::Addressee::Map &contacts)
 {
-    if (id == contactId()) {
-        setContact(contact);
+    //most contacts of a batch have no monitor
+    if (m_monitors.isEmpty()) {
+        return;
+    }
+    KABC::Addressee::Map::const_iterator it = contacts.constBegin();
+    for (; it != contacts.constEnd(); ++it) {
+        dispatch(it.key(), it.value());
     }
 }
 
-void DefaultContactMonitor::onContactChanged(const QString& id, const KABC::Addressee& contact)
+void ContactMonitorDispatcher::onContactsChanged(const KABC::Addressee::Map &contacts)
 {
-    if (id == contactId()) {
-        setContact(contact);
+    onContactsAdded(contacts);
+}
+
+void ContactMonitorDispatcher::onContactsRemoved(const QStringList &contactIds)
+{
+    Q_FOREACH (const QString &contactId, contactIds) {
+        dispatch(contactId, KABC::Addressee());
     }
 }
 
-void DefaultContactMonitor::onContactRemoved(const QString& id)
+DefaultContactMonitor::DefaultContactMonitor(const QString &contactId, const AllContactsMonitorPtr& allContactsWatcher,
+                                             ContactMonitorDispatcher *dispatcher):
+    ContactMonitor(contactId),
+    m_allContactsMonitor(allContactsWatcher),
+    m_dispatcher(dispatcher)
 {
-    if (id == contactId()) {
-        setContact(KABC::Addressee());
+    m_dispatcher->addMonitor(this);
+
+    const KABC::Addressee contact = m_allContactsMonitor->contact(contactId);
+    if (!contact.isEmpty()) {
+        setContact(contact);
     }
 }
 
+DefaultContactMonitor::~DefaultContactMonitor()
+{
+    m_dispatcher->removeMonitor(this);
+}
+
 
 
 #include "defaultcontactmonitor_p.moc"
@@ -20,12 +20,38 @@
 #define DEFAULTCONTACTMONITOR_H
 
 #include <QObject>
+#include <QMultiHash>
+#include <QPointer>
 
 #include "contactmonitor.h"
 #include "allcontactsmonitor.h"
 
 using namespace KPeople;
 
+class DefaultContactMonitor;
+
+/*
+ * Delivers the changes of an AllContactsMonitor to the DefaultContactMonitors of the changed contacts.
+ * It's a child of the AllContactsMonitor, so there is one for every monitor, and each change
+ * costs one hash lookup instead of a slot call for every DefaultContactMonitor.
+ */
+class ContactMonitorDispatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ContactMonitorDispatcher(AllContactsMonitor *allContactsMonitor);
+
+    void addMonitor(DefaultContactMonitor *monitor);
+    void removeMonitor(DefaultContactMonitor *monitor);
+private Q_SLOTS:
+    void onContactsAdded(const KABC::Addressee::Map &contacts);
+    void onContactsChanged(const KABC::Addressee::Map &contacts);
+    void onContactsRemoved(const QStringList &contactIds);
+private:
+    void dispatch(const QString &contactId, const KABC::Addressee &contact);
+    QMultiHash<QString, DefaultContactMonitor*> m_monitors;
+};
+
 /*
  * If plugins don't implement a ContactWatcher, we repurpose the whole model, and single out changes for one contact
  * ideally plugins (especially slow ones) will implement their own contact monitor.
@@ -35,13 +61,14 @@ class DefaultContactMonitor : public ContactMonitor
 {
     Q_OBJECT
 public:
-    DefaultContactMonitor(const QString &contactId, const AllContactsMonitorPtr &allContactsWatcher);
-private Q_SLOTS:
-    void onContactAdded(const QString &contactId, const KABC::Addressee &contact);
-    void onContactChanged(const QString &contactId, const KABC::Addressee &contact);
-    void onContactRemoved(const QString &contactId);
+    DefaultContactMonitor(const QString &contactId, const AllContactsMonitorPtr &allContactsWatcher,
+                          ContactMonitorDispatcher *dispatcher);
+    virtual ~DefaultContactMonitor();
 private:
+    friend class ContactMonitorDispatcher;
     AllContactsMonitorPtr m_allContactsMonitor;
+    //owned by m_allContactsMonitor, so it lives as long as we do
+    ContactMonitorDispatcher *m_dispatcher;
 };
 
 #endif // DEFAULTCONTACTMONITOR_H
@@ -23,7 +23,10 @@
 #include "abstractpersonaction.h"
 
 #include <KIconLoader>
+#include <KGlobal>
 #include <QIcon>
+#include <QCache>
+#include <QAction>
 
 static const KCatalogLoader i18nLoader("libkpeople");
 
@@ -35,6 +38,11 @@ QString KPeople::mergeContacts(const QStringList &ids)
     return PersonManager::instance()->mergeContacts(ids);
 }
 
+QStringList KPeople::mergeContactsBatch(const QList<QStringList> &groups)
+{
+    return PersonManager::instance()->mergeContactsBatch(groups);
+}
+
 bool KPeople::unmergeContact(const QString &id)
 {
     return PersonManager::instance()->unmergeContact(id);
@@ -52,6 +60,69 @@ QList<QAction*> KPeople::actionsForPerson(const KABC::Addressee &person,
     return actions;
 }
 
+namespace {
+//the actions built for a person, they're parented to owner
+struct CachedActions
+{
+    CachedActions(const QString &fingerprint):
+        fingerprint(fingerprint),
+        owner(new QObject)
+    {}
+
+    ~CachedActions()
+    {
+        //the actions could be shown in a menu right now
+        owner->deleteLater();
+    }
+
+    QString fingerprint;
+    QObject *owner;
+    QList<QAction*> actions;
+};
+
+typedef QCache<QString, CachedActions> ActionCache;
+}
+
+//persons whose actions are kept around, enough for a visible contact list
+static const int s_actionCacheSize = 100;
+
+K_GLOBAL_STATIC_WITH_ARGS(ActionCache, s_actionCache, (s_actionCacheSize));
+
+//everything plugins look at to build their actions; the whole string is compared,
+//a hash of it could match for different details and keep outdated actions
+static QString actionsFingerprint(const KABC::Addressee &person, const KABC::AddresseeList &contacts)
+{
+    QStringList fields;
+    fields << person.uid() << person.formattedName();
+    fields << person.emails();
+    Q_FOREACH(const KABC::PhoneNumber &number, person.phoneNumbers()) {
+        fields << number.number();
+    }
+    fields << person.customs();
+    Q_FOREACH(const KABC::Addressee &contact, contacts) {
+        fields << contact.uid() << contact.emails() << contact.customs();
+    }
+    return fields.join(QLatin1String("\n"));
+}
+
+QList<QAction*> KPeople::cachedActionsForPerson(const QString &personId,
+                                                const KABC::Addressee &person,
+                                                const KABC::AddresseeList &contacts)
+{
+    const QString fingerprint = actionsFingerprint(person, contacts);
+    CachedActions *cached = s_actionCache->object(personId);
+    if (cached && cached->fingerprint == fingerprint) {
+        return cached->actions;
+    }
+
+    cached = new CachedActions(fingerprint);
+    cached->actions = actionsForPerson(person, contacts, cached->owner);
+    const QList<QAction*> actions = cached->actions;
+    //replaces and deletes an outdated entry
+    s_actionCache->insert(personId, cached);
+    return actions;
+}
+
 QString KPeople::iconNameForPresenceString(const QString& presenceName)
 {
     if (presenceName == QLatin1String("available")) {
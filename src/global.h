@@ -37,9 +37,25 @@ namespace KPeople
      * @arg ids a list of all identifiers to be merged
      *
      * @return the identifier of the new person or an empty string upon failure
+     *
+     * This blocks until the merge is written to disk, use KPeople::MergeContactsJob
+     * to merge without blocking.
      */
     KPEOPLE_EXPORT QString mergeContacts(const QStringList &ids);
 
+    /**
+     * Merge each list of ids in @p groups into a person of its own.
+     *
+     * All merges are written in a single transaction and announced to other
+     * clients at once, which is a lot faster than calling mergeContacts() for
+     * every group when merging many groups.
+     *
+     * @return the identifier of the person for each group, in the same order;
+     * an empty string for groups which could not be merged, or an empty list
+     * if nothing could be written
+     */
+    KPEOPLE_EXPORT QStringList mergeContactsBatch(const QList<QStringList> &groups);
+
     /**
      * Unmerge a contact. Either remove a contact from a given person or remove a person
      *
@@ -51,6 +67,21 @@ namespace KPeople
                                                     const KABC::AddresseeList &contacts,
                                                     QObject *parent);
 
+    /**
+     * Like actionsForPerson(), but the actions are kept in a cache keyed by @p personId
+     * and only built again once the person's contact details change.
+     *
+     * The actions are owned by the cache, never delete them. Any later call can replace them
+     * or push the person out of the cache, after which they are deleted with deleteLater().
+     * So they can be shown in a menu which is open right now, but must not be stored;
+     * use actionsForPerson() for actions which have to stay around.
+     *
+     * Only call this from the GUI thread.
+     */
+    KPEOPLE_EXPORT QList<QAction*> cachedActionsForPerson(const QString &personId,
+                                                          const KABC::Addressee &person,
+                                                          const KABC::AddresseeList &contacts);
+
     /**
      * Return a QPixmap for a TP presence string
      *
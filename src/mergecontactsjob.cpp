@@ -0,0 +1,78 @@
+/*
+    Copyright (C) 2013  David Edmundson <davidedmundson@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "mergecontactsjob.h"
+
+#include "personmanager_p.h"
+
+#include <KLocalizedString>
+
+namespace KPeople {
+class MergeContactsJobPrivate
+{
+public:
+    QStringList ids;
+    QString personId;
+};
+}
+
+using namespace KPeople;
+
+MergeContactsJob::MergeContactsJob(const QStringList &ids, QObject *parent):
+    KJob(parent),
+    d_ptr(new MergeContactsJobPrivate)
+{
+    Q_D(MergeContactsJob);
+    d->ids = ids;
+}
+
+MergeContactsJob::~MergeContactsJob()
+{
+    delete d_ptr;
+}
+
+void MergeContactsJob::start()
+{
+    PersonManager::instance()->queueMerge(this);
+}
+
+QStringList MergeContactsJob::ids() const
+{
+    Q_D(const MergeContactsJob);
+    return d->ids;
+}
+
+QString MergeContactsJob::personId() const
+{
+    Q_D(const MergeContactsJob);
+    return d->personId;
+}
+
+void MergeContactsJob::finishMerge(const QString &personId)
+{
+    Q_D(MergeContactsJob);
+
+    d->personId = personId;
+    if (personId.isEmpty()) {
+        setError(UserDefinedError);
+        setErrorText(i18n("Could not merge contacts"));
+    }
+    emitResult();
+}
+
+#include "mergecontactsjob.moc"
@@ -0,0 +1,73 @@
+/*
+    Copyright (C) 2013  David Edmundson <davidedmundson@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef MERGECONTACTSJOB_H
+#define MERGECONTACTSJOB_H
+
+#include <KJob>
+#include <QStringList>
+
+#include "kpeople_export.h"
+
+class PersonManager;
+
+namespace KPeople
+{
+class MergeContactsJobPrivate;
+
+/**
+ * Asynchronous version of KPeople::mergeContacts()
+ *
+ * The merge is written by a separate database thread so the caller never blocks on disk access.
+ * Merges started in quick succession are committed together.
+ */
+class KPEOPLE_EXPORT MergeContactsJob : public KJob
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @arg ids a list of all identifiers to be merged, a mix of person IDs and contact IDs
+     */
+    explicit MergeContactsJob(const QStringList &ids, QObject *parent = 0);
+    virtual ~MergeContactsJob();
+
+    virtual void start();
+
+    /**
+     * The identifiers to be merged
+     */
+    QStringList ids() const;
+
+    /**
+     * The identifier of the new person.
+     * Only valid once the job finished without an error
+     */
+    QString personId() const;
+
+private:
+    friend class ::PersonManager;
+    void finishMerge(const QString &personId);
+
+    Q_DISABLE_COPY(MergeContactsJob)
+    Q_DECLARE_PRIVATE(MergeContactsJob)
+    MergeContactsJobPrivate * d_ptr;
+};
+}
+
+#endif // MERGECONTACTSJOB_H
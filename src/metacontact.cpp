@@ -20,14 +20,39 @@
 #include "metacontact_p.h"
 #include "global.h"
 #include <QSharedData>
+#include <QVector>
 
 namespace KPeople {
+//one contact of a person. Nodes are never modified after creation so they are shared
+//between all copies of a MetaContact; updating a contact only replaces its own node
+class MetaContactNode : public QSharedData
+{
+public:
+    MetaContactNode(const QString &contactId, const KABC::Addressee &contact):
+        contactId(contactId),
+        contact(contact)
+    {
+    }
+
+    const QString contactId;
+    const KABC::Addressee contact;
+};
+
+typedef QExplicitlySharedDataPointer<MetaContactNode> MetaContactNodePtr;
+
 class MetaContactData : public QSharedData
 {
 public:
+    //most persons only have a single contact. These are stored compactly as just the
+    //contact ID and the contact itself in personAddressee; the node list stays empty
+    //until a second contact is inserted
+    bool isSingleContact() const {
+        return !singleContactId.isEmpty();
+    }
+
     QString personId;
-    QStringList contactIds;
-    KABC::AddresseeList contacts; //TODO vector
+    QString singleContactId;
+    QVector<MetaContactNodePtr> contacts;
     KABC::Addressee personAddressee;
 };
 }
@@ -88,27 +113,75 @@ QString MetaContact::id() const
 
 bool MetaContact::isValid() const
 {
-    return !d->contacts.isEmpty();
+    return d->isSingleContact() || !d->contacts.isEmpty();
 }
 
 QStringList MetaContact::contactIds() const
 {
-    return d->contactIds;
+    if (d->isSingleContact()) {
+        return QStringList() << d->singleContactId;
+    }
+
+    QStringList contactIds;
+    contactIds.reserve(d->contacts.size());
+    Q_FOREACH(const MetaContactNodePtr &node, d->contacts) {
+        contactIds.append(node->contactId);
+    }
+    return contactIds;
+}
+
+int MetaContact::contactCount() const
+{
+    if (d->isSingleContact()) {
+        return 1;
+    }
+    return d->contacts.size();
+}
+
+int MetaContact::indexOfContact(const QString &contactId) const
+{
+    if (d->isSingleContact()) {
+        return d->singleContactId == contactId ? 0 : -1;
+    }
+
+    for (int i = 0; i < d->contacts.size(); i++) {
+        if (d->contacts.at(i)->contactId == contactId) {
+            return i;
+        }
+    }
+    return -1;
 }
 
 KABC::Addressee MetaContact::contact(const QString& contactId)
 {
-    int index = d->contactIds.indexOf(contactId);
-    if (index >= 0) {
-        return d->contacts[index];
-    } else {
+    return contactAt(indexOfContact(contactId));
+}
+
+KABC::Addressee MetaContact::contactAt(int index) const
+{
+    if (index < 0 || index >= contactCount()) {
         return KABC::Addressee();
     }
+    if (d->isSingleContact()) {
+        return d->personAddressee;
+    }
+    return d->contacts.at(index)->contact;
 }
 
 KABC::AddresseeList MetaContact::contacts() const
 {
-    return d->contacts;
+    if (d->isSingleContact()) {
+        KABC::AddresseeList contacts;
+        contacts.append(d->personAddressee);
+        return contacts;
+    }
+
+    KABC::AddresseeList contacts;
+    contacts.reserve(d->contacts.size());
+    Q_FOREACH(const MetaContactNodePtr &node, d->contacts) {
+        contacts.append(node->contact);
+    }
+    return contacts;
 }
 
 const KABC::Addressee& MetaContact::personAddressee() const
@@ -123,37 +196,84 @@ int MetaContact::insertContact(const QString &contactId, const KABC::Addressee &
     return index;
 }
 
+int MetaContact::insertContacts(const KABC::Addressee::Map &contacts)
+{
+    int index = -1;
+    KABC::Addressee::Map::const_iterator it = contacts.constBegin();
+    for (; it != contacts.constEnd(); ++it) {
+        const int inserted = insertContactInternal(it.key(), it.value());
+        if (index < 0) {
+            index = inserted;
+        }
+    }
+    reload();
+    return index;
+}
 
 int MetaContact::insertContactInternal(const QString &contactId, const KABC::Addressee &contact)
 {
-    if (d->contactIds.contains(contactId)) {
+    if (indexOfContact(contactId) >= 0) {
         //if item is already listed, do nothing.
         return -1;
-    } else {
-        //TODO if from the local address book - prepend to give higher priority.
-        int index = d->contacts.size();
-        d->contacts.append(contact);
-        d->contactIds.append(contactId);
-        return index;
     }
+
+    if (!isValid()) {
+        //first contact, use the compact representation
+        d->singleContactId = contactId;
+        d->personAddressee = contact;
+        return 0;
+    }
+
+    //switch to the full representation on the first merge
+    if (d->isSingleContact()) {
+        d->contacts.append(MetaContactNodePtr(new MetaContactNode(d->singleContactId, d->personAddressee)));
+        d->singleContactId.clear();
+    }
+
+    //TODO if from the local address book - prepend to give higher priority.
+    int index = d->contacts.size();
+    d->contacts.append(MetaContactNodePtr(new MetaContactNode(contactId, contact)));
+    return index;
 }
 
 int MetaContact::updateContact(const QString& contactId, const KABC::Addressee& contact)
 {
-    const int index = d->contactIds.indexOf(contactId);
-    if (index >= 0) {
-        d->contacts[index] = contact;
+    const int index = indexOfContact(contactId);
+    if (index < 0) {
+        return index;
+    }
+
+    if (d->isSingleContact()) {
+        d->personAddressee = contact;
+    } else {
+        //replace just this contact's node, the other nodes stay shared with any copies
+        d->contacts[index] = MetaContactNodePtr(new MetaContactNode(contactId, contact));
+        reload();
     }
-    reload();
     return index;
 }
 
 int MetaContact::removeContact(const QString& contactId)
 {
-    const int index = d->contactIds.indexOf(contactId);
-    if (index >= 0) {
-        d->contacts.removeAt(index);
-        d->contactIds.removeAt(index);
+    const int index = indexOfContact(contactId);
+    if (index < 0) {
+        return index;
+    }
+
+    if (d->isSingleContact()) {
+        d->singleContactId.clear();
+        d->personAddressee = KABC::Addressee();
+        return index;
+    }
+
+    d->contacts.remove(index);
+
+    //back down to one contact, go back to the compact representation
+    if (d->contacts.size() == 1) {
+        d->singleContactId = d->contacts.first()->contactId;
+        d->personAddressee = d->contacts.first()->contact;
+        d->contacts = QVector<MetaContactNodePtr>();
+    } else {
         reload();
     }
     return index;
@@ -165,15 +285,16 @@ void MetaContact::reload()
 
     //TODO - long term goal: resource priority - local vcards for "people" trumps anything else. So we can set a preferred name etc.
 
-    //Optimization, if only one contact use that for everything
-    if (d->contacts.size() == 1) {
-        d->personAddressee = d->contacts.first();
+    //a single contact is its own person addressee already
+    if (d->isSingleContact()) {
         return;
     }
 
     d->personAddressee = KABC::Addressee();
 
-    Q_FOREACH(const KABC::Addressee &contact, d->contacts) {
+    Q_FOREACH(const MetaContactNodePtr &node, d->contacts) {
+        const KABC::Addressee &contact = node->contact;
+
         //set items with multiple cardinality
         Q_FOREACH(const KABC::Address &address, contact.addresses()) {
             d->personAddressee.insertAddress(address);
@@ -50,7 +50,14 @@ public:
     QStringList contactIds() const;
     KABC::AddresseeList contacts() const;
 
+    /** The number of contacts in this person. Cheaper than contacts().size()*/
+    int contactCount() const;
+
+    /** Returns the position of @p contactId in this person, or -1 if it is not part of it*/
+    int indexOfContact(const QString &contactId) const;
+
     KABC::Addressee contact(const QString &contactId);
+    KABC::Addressee contactAt(int index) const;
     const KABC::Addressee& personAddressee() const;
 
     //update one of the stored contacts in this metacontact object
@@ -58,6 +65,10 @@ public:
 
     int insertContact(const QString &contactId, const KABC::Addressee &contact);
 
+    //insert several contacts at once, only recalculating the person once
+    //@return the index of the first contact which was inserted
+    int insertContacts(const KABC::Addressee::Map &contacts);
+
     int updateContact(const QString &contactId, const KABC::Addressee &contact);
 
     int removeContact(const QString &contactId);
@@ -23,6 +23,7 @@
 #include "personpluginmanager_p.h"
 #include "basepersonsdatasource.h"
 #include "contactmonitor.h"
+#include "contactid_p.h"
 
 #include <QDebug>
 
@@ -43,25 +44,32 @@ KPeople::PersonData::PersonData(const QString &id, QObject* parent):
 {
     Q_D(PersonData);
 
+    //parsed once, a contact which isn't part of a person routes with it below
+    const ContactId parsedId(id);
     QString personId;
     //query DB
-    if (id.startsWith("kpeople://")) {
+    if (parsedId.isPerson()) {
         personId = id;
     } else {
         personId = PersonManager::instance()->personIdForContact(id);
     }
 
+    QList<ContactId> parsedContactIds;
     if (personId.isEmpty()) {
         d->contactIds = QStringList() << id;
+        parsedContactIds << parsedId;
     } else {
         d->contactIds = PersonManager::instance()->contactsForPersonId(personId);
+        Q_FOREACH(const QString &contactId, d->contactIds) {
+            parsedContactIds << ContactId(contactId);
+        }
     }
 
     KABC::Addressee::Map contacts;
-    Q_FOREACH(const QString &contactId, d->contactIds) {
+    Q_FOREACH(const ContactId &parsedContactId, parsedContactIds) {
+        const QString &contactId = parsedContactId.toString();
         //load the correct data source for this contact ID
-        const QString sourceId = contactId.left(contactId.indexOf("://"));
-        BasePersonsDataSource *dataSource = PersonPluginManager::dataSource(sourceId);
+        BasePersonsDataSource *dataSource = PersonPluginManager::dataSource(parsedContactId);
         if (dataSource) {
             ContactMonitorPtr cw = dataSource->contactMonitor(contactId);
             d->watchers << cw;
@@ -102,7 +110,7 @@ void PersonData::onContactChanged()
 
 
     ContactMonitor *watcher = qobject_cast<ContactMonitor*>(sender());
-    if (d->metaContact.contactIds().contains(watcher->contactId())) {
+    if (d->metaContact.indexOfContact(watcher->contactId()) >= 0) {
         d->metaContact.updateContact(watcher->contactId(), watcher->contact());
     } else {
         d->metaContact.insertContact(watcher->contactId(), watcher->contact());
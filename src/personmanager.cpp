@@ -25,123 +25,486 @@
 #include <QSqlError>
 #include <QDBusConnection>
 #include <QDBusMessage>
+#include <QDBusServiceWatcher>
+#include <QThread>
+#include <QCoreApplication>
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <QMutexLocker>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QDateTime>
 #include <KStandardDirs>
+#include <KDebug>
+
+#include <KLockFile>
+
+#include "mergecontactsjob.h"
+#include "personsnapshot_p.h"
+#include "contactid_p.h"
+
+using KPeople::ContactId;
+
+//the SQLite result code for a database locked by another connection, we don't link to SQLite directly
+static const int s_sqliteBusy = 5;
+
+//how long SQLite waits for another writer before giving up, in milliseconds
+static const int s_busyTimeout = 2000;
+
+//how often a write transaction is attempted before it fails, each attempt waits s_busyTimeout
+static const int s_maxBeginAttempts = 3;
+
+//starting a write transaction which takes longer than this waited for another writer, in milliseconds
+static const int s_writeWaitThreshold = 5;
+
+//number of write transactions which waited for another writer, see PersonManager::writeConflicts()
+static QAtomicInt s_writeConflicts(0);
+
+//timing of the calls into PersonManager, shared by all threads and connections of the process
+static QMutex s_statisticsMutex;
+static PersonManager::QueryStatistics s_statistics[PersonManager::QueryKindCount];
+
+//in milliseconds, -1 until read from KPEOPLE_SLOW_QUERY_MS or set
+static QAtomicInt s_slowQueryThreshold(-1);
+
+static const char * const s_queryKindNames[PersonManager::QueryKindCount] = {
+    "allPersons",
+    "personIdForContact",
+    "contactsForPersonId",
+    "merge",
+    "unmerge",
+    "commit"
+};
+
+static int slowQueryThreshold()
+{
+    int threshold = s_slowQueryThreshold;
+    if (threshold < 0) {
+        bool ok = false;
+        threshold = qgetenv("KPEOPLE_SLOW_QUERY_MS").toInt(&ok);
+        if (!ok || threshold < 0) {
+            threshold = 100;
+        }
+        s_slowQueryThreshold = threshold;
+    }
+    return threshold;
+}
+
+/**
+ * Adds the time from its construction to its destruction to the statistics of a query kind
+ */
+class QueryTimer
+{
+public:
+    explicit QueryTimer(PersonManager::QueryKind kind);
+    ~QueryTimer();
+private:
+    PersonManager::QueryKind m_kind;
+    QElapsedTimer m_timer;
+};
+
+QueryTimer::QueryTimer(PersonManager::QueryKind kind):
+    m_kind(kind)
+{
+    m_timer.start();
+}
+
+QueryTimer::~QueryTimer()
+{
+    const qint64 time = m_timer.nsecsElapsed() / 1000;
+
+    s_statisticsMutex.lock();
+    PersonManager::QueryStatistics &statistics = s_statistics[m_kind];
+    statistics.count++;
+    statistics.totalTime += time;
+    statistics.maxTime = qMax(statistics.maxTime, time);
+    s_statisticsMutex.unlock();
+
+    if (time > slowQueryThreshold() * 1000) {
+        kWarning() << "Slow persondb query:" << s_queryKindNames[m_kind] << "took" << time / 1000 << "ms";
+    }
+}
 
 class Transaction
 {
 public:
-    Transaction(const QSqlDatabase &db);
+    enum Mode {
+        Read,
+        Write
+    };
+
+    Transaction(const QSqlDatabase &db, Mode mode = Write);
+    //false if the transaction could not be started, nothing must be written then
+    bool isActive() const;
+    bool commit();
     void cancel();
     ~Transaction();
 private:
     QSqlDatabase m_db;
-    bool m_cancelled;
+    Mode m_mode;
+    bool m_finished;
 };
 
-Transaction::Transaction(const QSqlDatabase& db) :
+Transaction::Transaction(const QSqlDatabase& db, Mode mode) :
     m_db(db),
-    m_cancelled(false)
+    m_mode(mode),
+    m_finished(false)
 {
-    m_db.transaction();
+    if (mode == Read) {
+        m_finished = !m_db.transaction();
+        return;
+    }
+
+    //other processes write to the same database, so take the write lock right away; with a
+    //deferred transaction the IDs we allocate could be taken by someone else before we write
+    //SQLite waits for the lock inside BEGIN for up to the busy timeout, so the time spent
+    //there tells whether another writer held it
+    QElapsedTimer waitTimer;
+    waitTimer.start();
+    QSqlQuery begin(m_db);
+    for (int attempt = 1; ; attempt++) {
+        if (begin.exec("BEGIN IMMEDIATE")) {
+            if (waitTimer.elapsed() >= s_writeWaitThreshold) {
+                s_writeConflicts.ref();
+            }
+            return;
+        }
+        if (begin.lastError().number() != s_sqliteBusy || attempt == s_maxBeginAttempts) {
+            kWarning() << "Could not start a transaction" << begin.lastError().text();
+            if (begin.lastError().number() == s_sqliteBusy) {
+                s_writeConflicts.ref();
+            }
+            m_finished = true;
+            return;
+        }
+        kWarning() << "persondb is locked by another writer, trying again";
+    }
+}
+
+bool Transaction::isActive() const
+{
+    return !m_finished;
+}
+
+bool Transaction::commit()
+{
+    if (m_finished) {
+        return false;
+    }
+    m_finished = true;
+    if (m_mode == Read) {
+        //only ends the read snapshot, there is nothing to write
+        return m_db.commit();
+    }
+    QueryTimer timer(PersonManager::CommitQuery);
+    return m_db.commit();
 }
 
 void Transaction::cancel()
 {
+    if (m_finished) {
+        return;
+    }
     m_db.rollback();
-    m_cancelled = true;
+    m_finished = true;
 }
 
 Transaction::~Transaction()
 {
-    if (!m_cancelled) {
+    if (!m_finished) {
         m_db.commit();
     }
 }
 
-PersonManager::PersonManager(const QString &databasePath, QObject *parent):
-    QObject(parent),
-    m_db(QSqlDatabase::addDatabase("QSQLITE"))
+/**
+ * Holds prepared statements for a database connection, so that queries which are run
+ * over and over again are only parsed and planned by SQLite once.
+ */
+class StatementCache
 {
-    m_db.setDatabaseName(databasePath);
-    m_db.open();
-    m_db.exec("CREATE TABLE IF NOT EXISTS persons (contactID VARCHAR UNIQUE NOT NULL, personID INT NOT NULL)");
-    m_db.exec("CREATE INDEX IF NOT EXISTS contactIdIndex ON persons (contactId)");
-    m_db.exec("CREATE INDEX IF NOT EXISTS personIdIndex ON persons (personId)");
+public:
+    /**
+     * If @p ownsConnection is set, the connection is closed and removed with the cache
+     */
+    StatementCache(const QSqlDatabase &db, bool ownsConnection = false);
+    ~StatementCache();
+
+    QSqlDatabase database() const;
+
+    /**
+     * Returns the query for @p sql, preparing it the first time it is requested.
+     * The returned query is shared, bind all values before every exec()
+     */
+    QSqlQuery& query(const QString &sql);
+private:
+    QSqlDatabase m_db;
+    bool m_ownsConnection;
+    QHash<QString, QSqlQuery> m_queries;
+};
 
-    QDBusConnection::sessionBus().connect(QString(), QString("/KPeople"), "org.kde.KPeople", "ContactAddedToPerson", this, SIGNAL(contactAddedToPerson(const QString&, const QString&)));
-    QDBusConnection::sessionBus().connect(QString(), QString("/KPeople"), "org.kde.KPeople", "ContactRemovedFromPerson", this, SIGNAL(contactRemovedFromPerson(const QString&)));
+StatementCache::StatementCache(const QSqlDatabase &db, bool ownsConnection):
+    m_db(db),
+    m_ownsConnection(ownsConnection)
+{
 }
 
-PersonManager::~PersonManager()
+StatementCache::~StatementCache()
 {
+    m_queries.clear();
+    if (m_ownsConnection) {
+        //removeDatabase() wants all handles to the connection gone
+        const QString connectionName = m_db.connectionName();
+        m_db.close();
+        m_db = QSqlDatabase();
+        QSqlDatabase::removeDatabase(connectionName);
+    }
+}
 
+QSqlDatabase StatementCache::database() const
+{
+    return m_db;
 }
 
-QMultiHash< QString, QString > PersonManager::allPersons() const
+QSqlQuery& StatementCache::query(const QString &sql)
 {
-    QMultiHash<QString /*PersonID*/, QString /*ContactID*/> contactMapping;
+    QHash<QString, QSqlQuery>::iterator it = m_queries.find(sql);
+    if (it == m_queries.end()) {
+        QSqlQuery query(m_db);
+        if (!query.prepare(sql)) {
+            kWarning() << "Could not prepare" << sql << query.lastError().text();
+        }
+        it = m_queries.insert(sql, query);
+    }
+    return it.value();
+}
 
-    QSqlQuery query = m_db.exec("SELECT personID, contactID FROM persons");
-    while (query.next()) {
-        const QString personId = "kpeople://" + query.value(0).toString(); // we store as ints internally, convert it to a string here
-        const QString contactID = query.value(1).toString();
-        contactMapping.insertMulti(personId, contactID);
+static QSqlDatabase openDatabase(const QString &databasePath, const QString &connectionName)
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(databasePath);
+    db.setConnectOptions(QString("QSQLITE_BUSY_TIMEOUT=%1").arg(s_busyTimeout));
+    if (!db.open()) {
+        kWarning() << "Could not open" << databasePath << db.lastError().text();
     }
-    return contactMapping;
+
+    //WAL lets other processes keep reading while we write, and in WAL mode synchronous=NORMAL
+    //can only lose the last commits on power loss, it can't corrupt the database
+    db.exec("PRAGMA journal_mode = WAL");
+    db.exec("PRAGMA synchronous = NORMAL");
+    db.exec("PRAGMA cache_size = -4096"); //in KiB
+    db.exec("PRAGMA mmap_size = 67108864");
+    db.exec("PRAGMA temp_store = MEMORY");
+    return db;
 }
 
-QStringList PersonManager::contactsForPersonId(const QString& personId) const
+//the layout of persondb, bump this and extend updateSchema() whenever it changes
+static const int s_schemaVersion = 3;
+
+//person IDs are stored as plain integers, outside of the database they are "kpeople://<number>"
+static QString personIdToString(qint64 personId)
 {
-    if (!personId.startsWith("kpeople://")) {
-        return QStringList();
+    return QLatin1String("kpeople://") + QString::number(personId);
+}
+
+//contacts are stored split into the ID of their source and the ID local to that source,
+//i.e akonadi://?item=15 is stored as "akonadi" and "?item=15", see ContactId
+static QString joinContactId(const QString &source, const QString &localId)
+{
+    if (source.isEmpty()) {
+        return localId;
     }
+    return source + QLatin1String("://") + localId;
+}
 
-    QStringList contactIds;
-    //TODO port to the proper qsql method for args
-    QSqlQuery query(m_db);
-    query.prepare("SELECT contactID FROM persons WHERE personId = ?");
-    query.bindValue(0, personId.mid(strlen("kpeople://")));
-    query.exec();
+/**
+ * Creates the tables of persondb, or migrates them from an older layout.
+ *
+ * Version 1 (no user_version set) was a single persons table with the full contact ID
+ * as text, version 2 keeps the contact IDs once in the contacts table and maps
+ * their integer keys to person IDs in a WITHOUT ROWID table.
+ * Version 3 adds the change journal.
+ */
+static int schemaVersion(QSqlDatabase &db)
+{
+    QSqlQuery versionQuery = db.exec("PRAGMA user_version");
+    const int version = versionQuery.next() ? versionQuery.value(0).toInt() : 0;
+    versionQuery.finish();
+    return version;
+}
 
-    while (query.next()) {
-        contactIds << query.value(0).toString();
+static void updateSchema(QSqlDatabase &db)
+{
+    //almost always up to date already, don't take the write lock just to find out
+    if (schemaVersion(db) >= s_schemaVersion) {
+        return;
+    }
+
+    Transaction transaction(db);
+    if (!transaction.isActive()) {
+        return;
+    }
+
+    //another process might have migrated it while we waited for the lock
+    const int version = schemaVersion(db);
+    if (version >= s_schemaVersion) {
+        return;
+    }
+
+    if (version < 2) {
+        const bool hasVersion1 = db.tables().contains(QLatin1String("persons"));
+        if (hasVersion1) {
+            //the indexes keep their names when the table is renamed, drop them so the new ones can be created
+            db.exec("DROP INDEX IF EXISTS contactIdIndex");
+            db.exec("DROP INDEX IF EXISTS personIdIndex");
+            db.exec("ALTER TABLE persons RENAME TO persons_v1");
+        }
+
+        db.exec("CREATE TABLE contacts (id INTEGER PRIMARY KEY, source TEXT NOT NULL, localId TEXT NOT NULL, UNIQUE (source, localId))");
+        QSqlQuery createQuery = db.exec("CREATE TABLE persons (contactId INTEGER PRIMARY KEY, personId INTEGER NOT NULL) WITHOUT ROWID");
+        if (createQuery.lastError().isValid()) {
+            //WITHOUT ROWID needs SQLite 3.8.2, the table works the same without it, it's just bigger
+            db.exec("CREATE TABLE persons (contactId INTEGER PRIMARY KEY, personId INTEGER NOT NULL)");
+        }
+        db.exec("CREATE INDEX personIdIndex ON persons (personId)");
+
+        if (hasVersion1) {
+            QSqlQuery insertContact(db);
+            insertContact.prepare("INSERT OR IGNORE INTO contacts (source, localId) VALUES (?, ?)");
+            QSqlQuery insertPerson(db);
+            insertPerson.prepare("INSERT OR IGNORE INTO persons (contactId, personId) SELECT id, ? FROM contacts WHERE source = ? AND localId = ?");
+
+            QSqlQuery oldRows = db.exec("SELECT contactID, personID FROM persons_v1");
+            while (oldRows.next()) {
+                const ContactId contactId(oldRows.value(0).toString());
+                const QString source = contactId.source();
+                const QString localId = contactId.localId();
+                insertContact.bindValue(0, source);
+                insertContact.bindValue(1, localId);
+                insertContact.exec();
+
+                insertPerson.bindValue(0, oldRows.value(1).toLongLong());
+                insertPerson.bindValue(1, source);
+                insertPerson.bindValue(2, localId);
+                insertPerson.exec();
+            }
+            oldRows.finish();
+
+            db.exec("DROP TABLE persons_v1");
+        }
+    }
+
+    if (version < 3) {
+        //every change to the persons table is appended here, so clients can catch up on
+        //what they missed; AUTOINCREMENT makes sure a sequence number is never reused
+        db.exec("CREATE TABLE journal (seq INTEGER PRIMARY KEY AUTOINCREMENT, contactId TEXT NOT NULL, personId INTEGER)");
+    }
+
+    db.exec(QString("PRAGMA user_version = %1").arg(s_schemaVersion));
+    if (!transaction.commit()) {
+        kWarning() << "Could not update persondb to version" << s_schemaVersion << db.lastError().text();
     }
-    return contactIds;
 }
 
-QString PersonManager::personIdForContact(const QString& contactId) const
+//how many changes are kept in the journal, see PersonManager::setJournalLimit()
+static QAtomicInt s_journalLimit(10000);
+
+/**
+ * Appends the move of @p contactIds into the person numbered @p personId to the change journal,
+ * a negative @p personId records that the contacts are no longer part of any person.
+ * This must be run inside a transaction.
+ */
+static bool writeJournal(StatementCache &statements, const QStringList &contactIds, qint64 personId)
+{
+    const QVariant person = personId < 0 ? QVariant(QVariant::LongLong) : QVariant(personId);
+    QSqlQuery &query = statements.query("INSERT INTO journal (contactId, personId) VALUES (?, ?)");
+    Q_FOREACH (const QString &contactId, contactIds) {
+        query.bindValue(0, contactId);
+        query.bindValue(1, person);
+        if (!query.exec()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Drops the oldest journal entries above the limit.
+ * This is run as part of every write transaction, so the journal never grows much beyond it.
+ */
+static void compactJournal(StatementCache &statements)
 {
-    QSqlQuery query(m_db);
-    query.prepare("SELECT personId FROM persons WHERE contactId = ?");
-    query.bindValue(0, contactId);
+    const int limit = s_journalLimit;
+    if (limit <= 0) {
+        return;
+    }
+
+    QSqlQuery &query = statements.query("DELETE FROM journal WHERE seq <= (SELECT MAX(seq) FROM journal) - ?");
+    query.bindValue(0, limit);
+    query.exec();
+}
+
+/**
+ * Returns the sequence number of the newest journal entry, or 0 if there is none.
+ * Run inside a write transaction, this is the sequence of the changes just written.
+ */
+static qint64 currentSequence(StatementCache &statements)
+{
+    qint64 sequence = 0;
+    QSqlQuery &query = statements.query("SELECT MAX(seq) FROM journal");
     query.exec();
     if (query.next()) {
-        return "kpeople://"+query.value(0).toString();
+        sequence = query.value(0).toLongLong();
     }
-    return QString();
+    query.finish();
+    return sequence;
 }
 
+/**
+ * Returns the lowest person ID not used in the database yet.
+ * Writers allocate IDs from this once per transaction and count up from there.
+ */
+static qint64 firstFreePersonId(StatementCache &statements)
+{
+    // query for the highest existing ID in the database and +1 it
+    qint64 personId = 0;
+    QSqlQuery &query = statements.query("SELECT MAX(personId) FROM persons");
+    query.exec();
+    if (query.next()) {
+        personId = query.value(0).toLongLong();
+        personId++;
+    }
+    query.finish();
+    return personId;
+}
 
-QString PersonManager::mergeContacts(const QStringList& ids)
+/**
+ * Writes a merge of all @p ids into a single person.
+ * This must be run inside a transaction.
+ *
+ * @p nextPersonId is the ID given to a newly created person, it is incremented when used
+ * @p addedContacts is filled with all contacts which are now part of a different person
+ * @return the ID of the person, or an empty string if the merge could not be written
+ */
+static QString writeMerge(StatementCache &statements, const QStringList &ids, qint64 &nextPersonId, QStringList &addedContacts)
 {
     // no merging if we have only 0 || 1 ids
     if (ids.size() < 2) {
         return QString();
     }
 
-    QStringList metacontacts;
-    QStringList contacts;
+    QList<ContactId> metacontacts;
+    QList<ContactId> contacts;
 
     bool rc = true;
 
-    QList<QDBusMessage> pendingMessages;
-
     // separate the passed ids to metacontacts and simple contacts
     Q_FOREACH (const QString &id, ids) {
-        if (id.startsWith(QLatin1String("kpeople://"))) {
-            metacontacts << id;
+        const ContactId contactId(id);
+        if (contactId.isPerson()) {
+            metacontacts << contactId;
         } else {
-            contacts << id;
+            contacts << contactId;
         }
     }
 
@@ -149,138 +512,1120 @@ QString PersonManager::mergeContacts(const QStringList& ids)
     //   - if we're merging two simple contacts, create completely new id
     //   - if we're merging an existing metacontact, take the first id and use it
     QString personIdString;
+    qint64 personId = 0;
     if (metacontacts.count() == 0) {
-        // query for the highest existing ID in the database and +1 it
-        int personId = 0;
-        QSqlQuery query = m_db.exec(QString("SELECT MAX(personID) FROM persons"));
-        if (query.next()) {
-            personId = query.value(0).toInt();
-            personId++;
-        }
-
-        personIdString = "kpeople://" + QString::number(personId);
+        personId = nextPersonId++;
+        personIdString = personIdToString(personId);
     } else {
-        personIdString = metacontacts.first();
+        personIdString = metacontacts.first().toString();
+        personId = metacontacts.first().personId();
     }
 
-    // start a db transaction (ends automatically on destruction)
-    Transaction t(m_db);
-
     // processed passed metacontacts
     if (metacontacts.count() > 1) {
-        // collect all the contacts from other persons
-        QStringList personContacts;
-        Q_FOREACH (const QString &id, metacontacts) {
-            if (id != personIdString) {
-                personContacts << contactsForPersonId(id);
+        Q_FOREACH (const ContactId &id, metacontacts) {
+            const qint64 otherPersonId = id.personId();
+            if (otherPersonId == personId) {
+                continue;
             }
-        }
 
-        // iterate over all of the contacts and change their personID to the new personIdString
-        Q_FOREACH (const QString &id, personContacts) {
-            QSqlQuery updateQuery(m_db);
-            updateQuery.prepare("UPDATE persons SET personID = ? WHERE contactID = ?");
-            updateQuery.bindValue(0, personIdString.mid(strlen("kpeople://")));
-            updateQuery.bindValue(1, id);
+            // collect the contacts of the other person, they are announced as added
+            QSqlQuery &query = statements.query("SELECT contacts.source, contacts.localId FROM persons "
+                                                "JOIN contacts ON contacts.id = persons.contactId WHERE persons.personId = ?");
+            query.bindValue(0, otherPersonId);
+            query.exec();
+            while (query.next()) {
+                addedContacts << joinContactId(query.value(0).toString(), query.value(1).toString());
+            }
+            query.finish();
+
+            // and move all of them over to the new person at once
+            QSqlQuery &updateQuery = statements.query("UPDATE persons SET personId = ? WHERE personId = ?");
+            updateQuery.bindValue(0, personId);
+            updateQuery.bindValue(1, otherPersonId);
             if (!updateQuery.exec()) {
                 rc = false;
             }
-
-            QDBusMessage message = QDBusMessage::createSignal(QLatin1String("/KPeople"),
-                                                              QLatin1String("org.kde.KPeople"),
-                                                              QLatin1String("ContactRemovedFromPerson"));
-
-            message.setArguments(QVariantList() << id);
-            pendingMessages << message;
-
-            message = QDBusMessage::createSignal(QLatin1String("/KPeople"),
-                                                              QLatin1String("org.kde.KPeople"),
-                                                              QLatin1String("ContactAddedToPerson"));
-
-            message.setArguments(QVariantList() << id << personIdString);
-
         }
     }
 
     // process passed contacts
     if (contacts.size() > 0) {
+        Q_FOREACH (const ContactId &id, contacts) {
+            const QString source = id.source();
+            const QString localId = id.localId();
 
+            QSqlQuery &contactQuery = statements.query("INSERT OR IGNORE INTO contacts (source, localId) VALUES (?, ?)");
+            contactQuery.bindValue(0, source);
+            contactQuery.bindValue(1, localId);
+            if (!contactQuery.exec()) {
+                rc = false;
+            }
 
-        Q_FOREACH (const QString &id, contacts) {
-            QSqlQuery insertQuery(m_db);
-            insertQuery.prepare("INSERT INTO persons VALUES (?, ?)");
-            insertQuery.bindValue(0, id);
-            insertQuery.bindValue(1, personIdString.mid(strlen("kpeople://"))); //strip kpeople://
+            //fails if the contact is already part of a person, like the old UNIQUE contactID column did
+            QSqlQuery &insertQuery = statements.query("INSERT INTO persons (contactId, personId) "
+                                                      "SELECT id, ? FROM contacts WHERE source = ? AND localId = ?");
+            insertQuery.bindValue(0, personId);
+            insertQuery.bindValue(1, source);
+            insertQuery.bindValue(2, localId);
             if (!insertQuery.exec()) {
                 rc = false;
             }
-
-            //FUTURE OPTIMIZATION - this would be best as one signal, but arguments become complex
-            QDBusMessage message = QDBusMessage::createSignal(QLatin1String("/KPeople"),
-                                                        QLatin1String("org.kde.KPeople"),
-                                                        QLatin1String("ContactAddedToPerson"));
-
-            message.setArguments(QVariantList() << id << personIdString);
-            pendingMessages << message;
+            addedContacts << id.toString();
         }
     }
 
-    //if success send all messages to other clients
-    //otherwise roll back our database changes and return an empty string
     if (rc) {
-        Q_FOREACH(const QDBusMessage &message, pendingMessages) {
-            QDBusConnection::sessionBus().send(message);
-        }
-    } else {
-        t.cancel();
-        personIdString.clear();
+        rc = writeJournal(statements, addedContacts, personId);
     }
 
+    if (!rc) {
+        addedContacts.clear();
+        return QString();
+    }
     return personIdString;
 }
 
-bool PersonManager::unmergeContact(const QString &id)
+/**
+ * Replaces the snapshot at @p snapshotPath with the current contents of the database
+ */
+static void writeSnapshotFile(StatementCache &statements, const QString &snapshotPath)
 {
-    //remove rows from DB
-    if (id.startsWith("kpeople://")) {
-        QSqlQuery query(m_db);
+    //read the database while holding the lock, so whoever replaces the snapshot last also read last
+    KLockFile lock(snapshotPath + QLatin1String(".lock"));
+    if (lock.lock() != KLockFile::LockOK) {
+        kWarning() << "Could not lock" << snapshotPath;
+        return;
+    }
 
-        const QStringList contactIds = contactsForPersonId(id);
-        query.prepare("DELETE FROM persons WHERE personId = ?");
-        query.bindValue(0, id.mid(strlen("kpeople://")));
-        query.exec();
+    QStringList contactIds;
+    QVector<qint64> personIds;
+
+    Transaction t(statements.database(), Transaction::Read);
+    const qint64 sequence = currentSequence(statements);
+    QSqlQuery &query = statements.query("SELECT persons.personId, contacts.source, contacts.localId FROM persons "
+                                        "JOIN contacts ON contacts.id = persons.contactId");
+    query.exec();
+    while (query.next()) {
+        personIds << query.value(0).toLongLong();
+        contactIds << joinContactId(query.value(1).toString(), query.value(2).toString());
+    }
+    query.finish();
+    t.commit();
+
+    PersonSnapshot::write(snapshotPath, sequence, contactIds, personIds);
+}
+
+/**
+ * Returns false if the database at @p databasePath was changed after the snapshot at
+ * @p snapshotPath was written, only looking at the files so the database isn't opened.
+ *
+ * Writers replace the snapshot after every commit, so this only happens when a writer
+ * crashed in between, or when SQLite moved the log into the database file afterwards.
+ */
+static bool isSnapshotCurrent(const QString &snapshotPath, const QString &databasePath)
+{
+    const QDateTime written = QFileInfo(snapshotPath).lastModified();
+    //with WAL, commits only change the log until it is checkpointed into the database
+    Q_FOREACH (const QString &fileName, QStringList() << databasePath << databasePath + QLatin1String("-wal")) {
+        const QFileInfo info(fileName);
+        if (info.exists() && info.lastModified() > written) {
+            return false;
+        }
+    }
+    return true;
+}
 
-        Q_FOREACH(const QString &contactId, contactIds) {
-            //FUTURE OPTIMIZATION - this would be best as one signal, but arguments become complex
-            QDBusMessage message = QDBusMessage::createSignal(QLatin1String("/KPeople"),
+//the signal older clients listen to, sent for every contact next to the batched signals
+static QDBusMessage contactAddedToPersonMessage(const QString &contactId, const QString &personId)
+{
+    QDBusMessage message = QDBusMessage::createSignal(QLatin1String("/KPeople"),
                                                       QLatin1String("org.kde.KPeople"),
-                                                      QLatin1String("ContactRemovedFromPerson"));
+                                                      QLatin1String("ContactAddedToPerson"));
+    message.setArguments(QVariantList() << contactId << personId);
+    return message;
+}
+
+PersonManagerWorker::PersonManagerWorker(const QString &databasePath, const QString &snapshotPath):
+    QObject(),
+    m_databasePath(databasePath),
+    m_snapshotPath(snapshotPath),
+    m_statements(0)
+{
+}
+
+PersonManagerWorker::~PersonManagerWorker()
+{
+    //closeDatabase() has removed the connection already
+    Q_ASSERT(!m_statements);
+}
+
+void PersonManagerWorker::closeDatabase()
+{
+    //the connection belongs to this thread, it has to be removed here and not wherever we are deleted
+    m_db = QSqlDatabase();
+    delete m_statements;
+    m_statements = 0;
+}
+
+bool PersonManagerWorker::enqueue(const PendingMerge &merge)
+{
+    QMutexLocker locker(&m_mutex);
+    m_pendingMerges << merge;
+    return m_pendingMerges.size() == 1;
+}
+
+QList<PendingMerge> PersonManagerWorker::takeWrittenMerges()
+{
+    QMutexLocker locker(&m_mutex);
+    QList<PendingMerge> writtenMerges = m_writtenMerges;
+    m_writtenMerges.clear();
+    return writtenMerges;
+}
+
+void PersonManagerWorker::openConnection()
+{
+    //the connection has to be created in the thread which uses it
+    if (!m_statements) {
+        m_db = openDatabase(m_databasePath, QLatin1String("kpeople-writer"));
+        m_statements = new StatementCache(m_db, true);
+    }
+}
+
+void PersonManagerWorker::writePendingMerges()
+{
+    openConnection();
+
+    m_mutex.lock();
+    QList<PendingMerge> merges = m_pendingMerges;
+    m_pendingMerges.clear();
+    m_mutex.unlock();
+
+    if (merges.isEmpty()) {
+        return;
+    }
+
+    QueryTimer timer(PersonManager::MergeQuery);
+
+    //group commit: all merges queued while the previous group was written go into a single
+    //transaction; a savepoint per merge means one failing merge doesn't undo the others
+    Transaction t(m_db);
+    if (!t.isActive()) {
+        //report all of them as failed
+        m_mutex.lock();
+        m_writtenMerges << merges;
+        m_mutex.unlock();
+        Q_EMIT mergesWritten();
+        return;
+    }
 
-            message.setArguments(QVariantList() << contactId);
-            QDBusConnection::sessionBus().send(message);
+    //new IDs are allocated inside the write transaction, so no other writer can take them
+    qint64 nextPersonId = firstFreePersonId(*m_statements);
+    for (QList<PendingMerge>::iterator it = merges.begin(); it != merges.end(); ++it) {
+        m_statements->query("SAVEPOINT merge").exec();
+        it->personId = writeMerge(*m_statements, it->ids, nextPersonId, it->addedContacts);
+        if (it->personId.isEmpty()) {
+            m_statements->query("ROLLBACK TO merge").exec();
+        } else {
+            it->sequence = currentSequence(*m_statements);
         }
-    } else {
-        QSqlQuery query(m_db);
-        query.prepare("DELETE FROM persons WHERE contactId = ?");
-        query.bindValue(0, id);
-        query.exec();
-        //emit signal(dbus)
-        Q_EMIT contactRemovedFromPerson(id);
+        m_statements->query("RELEASE merge").exec();
     }
+    compactJournal(*m_statements);
 
-    //TODO return if removing rows worked
-    return true;
+    if (!t.commit()) {
+        kWarning() << "Could not commit merges" << m_db.lastError().text();
+        for (QList<PendingMerge>::iterator it = merges.begin(); it != merges.end(); ++it) {
+            it->personId.clear();
+            it->addedContacts.clear();
+        }
+    }
+
+    //other processes map the snapshot again when they hear about the merges, so it
+    //has to be replaced before anyone does
+    Q_FOREACH (const PendingMerge &merge, merges) {
+        if (!merge.personId.isEmpty()) {
+            writeSnapshotFile(*m_statements, m_snapshotPath);
+            break;
+        }
+    }
+
+    m_mutex.lock();
+    m_writtenMerges << merges;
+    m_mutex.unlock();
+
+    Q_EMIT mergesWritten();
 }
 
-PersonManager* PersonManager::instance(const QString &databasePath)
+PersonManager::PersonManager(const QString &databasePath, QObject *parent):
+    QObject(parent),
+    m_databasePath(databasePath),
+    m_statements(0),
+    m_schemaUpdated(false),
+    m_workerThread(0),
+    m_worker(0),
+    m_nextMergeId(0),
+    m_lastSequence(0),
+    m_sequenceMutex(QMutex::Recursive),
+    m_batchingClientWatcher(new QDBusServiceWatcher(this)),
+    m_snapshotPath(databasePath + QLatin1String(".snapshot")),
+    m_snapshot(new PersonSnapshot(m_snapshotPath)),
+    m_snapshotStale(false),
+    m_mirrorLock(QReadWriteLock::Recursive),
+    m_mirrorLoaded(false)
 {
-    static PersonManager* s_instance = 0;
-    if (!s_instance) {
-        QString path = databasePath;
-        if (path.isEmpty()) {
-            path = KGlobal::dirs()->locateLocal("data","kpeople/persondb");
+    //the database is only opened once something isn't in the snapshot, has to be caught up
+    //from the journal or is written
+
+    //our own changes are applied right away, the signals carry our unique bus name so we can skip them
+    m_origin = QDBusConnection::sessionBus().baseService();
+
+    m_batchingClientWatcher->setConnection(QDBusConnection::sessionBus());
+    m_batchingClientWatcher->setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    connect(m_batchingClientWatcher, SIGNAL(serviceUnregistered(QString)), SLOT(onBatchingClientGone(QString)));
+
+    QDBusConnection::sessionBus().connect(QString(), QString("/KPeople"), "org.kde.KPeople", "ContactsAddedToPerson", this, SLOT(onContactsAddedToPerson(QString,QStringList,QString,qlonglong)));
+    QDBusConnection::sessionBus().connect(QString(), QString("/KPeople"), "org.kde.KPeople", "ContactsRemovedFromPerson", this, SLOT(onContactsRemovedFromPerson(QStringList,QString,qlonglong)));
+    QDBusConnection::sessionBus().connect(QString(), QString("/KPeople"), "org.kde.KPeople", "ContactsMerged", this, SLOT(onContactsMerged(QStringList,QStringList,QString,qlonglong)));
+
+    //clients of older versions only know the signals for single contacts
+    QDBusConnection::sessionBus().connect(QString(), QString("/KPeople"), "org.kde.KPeople", "ContactAddedToPerson", this, SLOT(onContactAddedToPerson(QString,QString,QDBusMessage)));
+    QDBusConnection::sessionBus().connect(QString(), QString("/KPeople"), "org.kde.KPeople", "ContactRemovedFromPerson", this, SLOT(onContactRemovedFromPerson(QString,QDBusMessage)));
+}
+
+PersonManager::~PersonManager()
+{
+    if (m_workerThread) {
+        QMetaObject::invokeMethod(m_worker, "closeDatabase", Qt::BlockingQueuedConnection);
+        m_workerThread->quit();
+        m_workerThread->wait();
+        delete m_worker;
+        delete m_workerThread;
+    }
+    m_db = QSqlDatabase();
+    delete m_statements;
+    delete m_snapshot;
+}
+
+void PersonManager::prepareLookups() const
+{
+    {
+        QReadLocker locker(&m_mirrorLock);
+        if (m_mirrorLoaded || (m_snapshot->isMapped() && !m_snapshotStale)) {
+            return;
+        }
+    }
+
+    {
+        QWriteLocker locker(&m_mirrorLock);
+        //another thread might have got here while we waited for the lock
+        if (m_mirrorLoaded || (m_snapshot->isMapped() && !m_snapshotStale)) {
+            return;
+        }
+
+        //the snapshot of the last writer answers everything without opening the database
+        m_snapshotStale = false;
+        bool replaceSnapshot = true;
+        if (isSnapshotCurrent(m_snapshotPath, m_databasePath) && m_snapshot->map()) {
+            //changes we applied tell us how new the database is at least, before that we
+            //take the snapshot's word; the signals of newer changes catch us up from the journal
+            if (m_snapshot->sequence() >= m_lastSequence) {
+                if (m_lastSequence == 0) {
+                    m_lastSequence = m_snapshot->sequence();
+                }
+                return;
+            }
+
+            //its writer hasn't replaced it yet, it will once it is done
+            m_snapshot->unmap();
+            replaceSnapshot = false;
+        }
+
+        loadMirror();
+        if (!replaceSnapshot) {
+            return;
+        }
+    }
+
+    //there was no usable snapshot or one older than the database, spare the other processes
+    //from reading the database as well, without keeping all other lookups waiting while we do
+    writeSnapshot();
+}
+
+void PersonManager::loadMirror() const
+{
+    StatementCache &statements = threadStatements();
+
+    //the sequence has to match the rows, read both from the same snapshot of the database
+    Transaction t(statements.database(), Transaction::Read);
+    const qint64 sequence = currentSequence(statements);
+    QSqlQuery query = statements.database().exec("SELECT persons.personId, contacts.source, contacts.localId FROM persons "
+                                "JOIN contacts ON contacts.id = persons.contactId");
+    while (query.next()) {
+        const QString personId = personIdToString(query.value(0).toLongLong());
+        const QString contactId = joinContactId(query.value(1).toString(), query.value(2).toString());
+        m_contactToPerson.insert(contactId, personId);
+        m_personToContacts[personId].append(contactId);
+    }
+    query.finish();
+    t.commit();
+
+    if (m_lastSequence == 0) {
+        m_lastSequence = sequence;
+    }
+    m_mirrorLoaded = true;
+}
+
+void PersonManager::writeSnapshot() const
+{
+    writeSnapshotFile(threadStatements(), m_snapshotPath);
+}
+
+void PersonManager::mirrorAddContacts(const QString &personId, const QStringList &contactIds)
+{
+    QWriteLocker locker(&m_mirrorLock);
+
+    //the writer replaced the snapshot before announcing the change, map the new one on the next lookup
+    m_snapshotStale = true;
+
+    //if the mirror isn't loaded yet, it will read the change from the database once it is
+    if (!m_mirrorLoaded) {
+        return;
+    }
+
+    QStringList &personContacts = m_personToContacts[personId];
+    Q_FOREACH (const QString &contactId, contactIds) {
+        const QString oldPersonId = m_contactToPerson.value(contactId);
+        if (oldPersonId == personId) {
+            continue;
+        }
+        if (!oldPersonId.isEmpty()) {
+            QHash<QString, QStringList>::iterator it = m_personToContacts.find(oldPersonId);
+            if (it != m_personToContacts.end()) {
+                it.value().removeOne(contactId);
+                if (it.value().isEmpty()) {
+                    m_personToContacts.erase(it);
+                }
+            }
+        }
+        m_contactToPerson.insert(contactId, personId);
+        personContacts.append(contactId);
+    }
+}
+
+void PersonManager::mirrorRemoveContacts(const QStringList &contactIds)
+{
+    QWriteLocker locker(&m_mirrorLock);
+    m_snapshotStale = true;
+    if (!m_mirrorLoaded) {
+        return;
+    }
+
+    Q_FOREACH (const QString &contactId, contactIds) {
+        const QString personId = m_contactToPerson.take(contactId);
+        QHash<QString, QStringList>::iterator it = m_personToContacts.find(personId);
+        if (it != m_personToContacts.end()) {
+            it.value().removeOne(contactId);
+            if (it.value().isEmpty()) {
+                m_personToContacts.erase(it);
+            }
+        }
+    }
+}
+
+void PersonManager::setLastSequence(qint64 sequence)
+{
+    QWriteLocker locker(&m_mirrorLock);
+    m_lastSequence = sequence;
+}
+
+bool PersonManager::advanceSequence(qint64 sequence, int changeCount)
+{
+    QMutexLocker locker(&m_sequenceMutex);
+    const qint64 lastSequence = lastAppliedSequence();
+
+    //already applied, by our own write or while catching up after a gap
+    if (sequence <= lastSequence) {
+        return false;
+    }
+
+    //every contact of a change is one journal entry, so the change directly follows the last
+    //one we applied if it starts right after it; 0 means we haven't seen any change yet
+    if (lastSequence == 0 || sequence - changeCount == lastSequence) {
+        setLastSequence(sequence);
+        return true;
+    }
+
+    //we missed a change, catch up from the journal, which has this change as well
+    if (!replayChanges(lastSequence)) {
+        kWarning() << "Changes to persondb after" << lastSequence << "are no longer in the journal";
+        setLastSequence(sequence);
+        return true;
+    }
+    if (lastAppliedSequence() < sequence) {
+        //the journal doesn't have it, the database was replaced
+        setLastSequence(sequence);
+        return true;
+    }
+    return false;
+}
+
+bool PersonManager::replayChanges(qint64 sequence)
+{
+    QList<PersonChange> changes;
+    if (!changesSince(sequence, changes)) {
+        return false;
+    }
+
+    //consecutive changes into the same person are applied together
+    int first = 0;
+    while (first < changes.size()) {
+        const QString personId = changes.at(first).personId;
+        QStringList contactIds;
+        int last = first;
+        while (last < changes.size() && changes.at(last).personId == personId) {
+            contactIds << changes.at(last).contactId;
+            last++;
+        }
+
+        if (personId.isEmpty()) {
+            applyContactsRemoved(contactIds);
+        } else {
+            applyContactsAdded(personId, contactIds);
+        }
+        first = last;
+    }
+
+    if (!changes.isEmpty()) {
+        setLastSequence(changes.last().sequence);
+    }
+    return true;
+}
+
+bool PersonManager::isEcho(const QString &origin) const
+{
+    return !m_origin.isEmpty() && origin == m_origin;
+}
+
+void PersonManager::applyContactsAdded(const QString &newPersonId, const QStringList &contactIds)
+{
+    mirrorAddContacts(newPersonId, contactIds);
+    Q_EMIT contactsAddedToPerson(newPersonId, contactIds);
+}
+
+void PersonManager::applyContactsRemoved(const QStringList &contactIds)
+{
+    mirrorRemoveContacts(contactIds);
+    Q_EMIT contactsRemovedFromPerson(contactIds);
+}
+
+void PersonManager::onContactsAddedToPerson(const QString &newPersonId, const QStringList &contactIds, const QString &origin, qlonglong sequence)
+{
+    //our own changes were applied when they were written
+    if (isEcho(origin)) {
+        return;
+    }
+    addBatchingClient(origin);
+    if (advanceSequence(sequence, contactIds.size())) {
+        applyContactsAdded(newPersonId, contactIds);
+    }
+}
+
+void PersonManager::onContactsRemovedFromPerson(const QStringList &contactIds, const QString &origin, qlonglong sequence)
+{
+    if (isEcho(origin)) {
+        return;
+    }
+    addBatchingClient(origin);
+    if (advanceSequence(sequence, contactIds.size())) {
+        applyContactsRemoved(contactIds);
+    }
+}
+
+void PersonManager::onContactsMerged(const QStringList &personIds, const QStringList &contactIds, const QString &origin, qlonglong sequence)
+{
+    if (isEcho(origin)) {
+        return;
+    }
+    addBatchingClient(origin);
+
+    if (personIds.size() != contactIds.size()) {
+        kWarning() << "Ignoring malformed ContactsMerged signal";
+        return;
+    }
+
+    if (!advanceSequence(sequence, contactIds.size())) {
+        return;
+    }
+
+    //the contacts of each person are sent next to each other, split them back up per person
+    int first = 0;
+    while (first < personIds.size()) {
+        const QString &personId = personIds.at(first);
+        int last = first + 1;
+        while (last < personIds.size() && personIds.at(last) == personId) {
+            last++;
+        }
+        applyContactsAdded(personId, contactIds.mid(first, last - first));
+        first = last;
+    }
+}
+
+void PersonManager::addBatchingClient(const QString &origin)
+{
+    if (!m_batchingClients.contains(origin)) {
+        m_batchingClients.insert(origin);
+        m_batchingClientWatcher->addWatchedService(origin);
+    }
+}
+
+void PersonManager::onBatchingClientGone(const QString &origin)
+{
+    m_batchingClients.remove(origin);
+    m_batchingClientWatcher->removeWatchedService(origin);
+}
+
+void PersonManager::onContactAddedToPerson(const QString &contactId, const QString &newPersonId, const QDBusMessage &message)
+{
+    //clients of this version send both signals, the batched one was already applied
+    if (isEcho(message.service()) || m_batchingClients.contains(message.service())) {
+        return;
+    }
+    applyContactsAdded(newPersonId, QStringList() << contactId);
+}
+
+void PersonManager::onContactRemovedFromPerson(const QString &contactId, const QDBusMessage &message)
+{
+    if (isEcho(message.service()) || m_batchingClients.contains(message.service())) {
+        return;
+    }
+    applyContactsRemoved(QStringList() << contactId);
+}
+
+QMultiHash< QString, QString > PersonManager::allPersons() const
+{
+    QueryTimer timer(AllPersonsQuery);
+    prepareLookups();
+    QReadLocker locker(&m_mirrorLock);
+
+    QMultiHash<QString /*PersonID*/, QString /*ContactID*/> contactMapping;
+    if (!m_mirrorLoaded) {
+        for (int i = 0; i < m_snapshot->count(); i++) {
+            contactMapping.insertMulti(personIdToString(m_snapshot->personIdAt(i)), m_snapshot->contactIdAt(i));
+        }
+        return contactMapping;
+    }
+
+    QHash<QString, QString>::const_iterator it = m_contactToPerson.constBegin();
+    for (; it != m_contactToPerson.constEnd(); ++it) {
+        contactMapping.insertMulti(it.value(), it.key());
+    }
+    return contactMapping;
+}
+
+QStringList PersonManager::contactsForPersonId(const QString& personId) const
+{
+    QueryTimer timer(ContactsForPersonIdQuery);
+    const ContactId id(personId);
+    if (!id.isPerson()) {
+        return QStringList();
+    }
+
+    prepareLookups();
+    QReadLocker locker(&m_mirrorLock);
+    if (!m_mirrorLoaded) {
+        return m_snapshot->contactsForPersonId(id.personId());
+    }
+    return m_personToContacts.value(personId);
+}
+
+QString PersonManager::personIdForContact(const QString& contactId) const
+{
+    QueryTimer timer(PersonIdForContactQuery);
+    prepareLookups();
+    QReadLocker locker(&m_mirrorLock);
+    if (!m_mirrorLoaded) {
+        const qint64 personId = m_snapshot->personIdForContact(contactId);
+        return personId < 0 ? QString() : personIdToString(personId);
+    }
+    return m_contactToPerson.value(contactId);
+}
+
+StatementCache& PersonManager::threadStatements() const
+{
+    //the shared connection belongs to the thread of the instance, which is the main thread even
+    //if a worker thread asked for the instance first, see instance()
+    if (QThread::currentThread() == thread()) {
+        if (!m_statements) {
+            m_db = openDatabase(m_databasePath, QString("kpeople-%1").arg(quintptr(this), 0, 16));
+            m_statements = new StatementCache(m_db, true);
+            checkSchema(m_db);
+        }
+        return *m_statements;
+    }
+
+    //Qt connections can't be shared between threads, every other thread gets its own,
+    //which is closed again when the thread finishes
+    StatementCache *statements = m_threadStatements.localData();
+    if (!statements) {
+        const QString connectionName = QString("kpeople-%1").arg(quintptr(QThread::currentThread()), 0, 16);
+        QSqlDatabase db = openDatabase(m_databasePath, connectionName);
+        checkSchema(db);
+        statements = new StatementCache(db, true);
+        m_threadStatements.setLocalData(statements);
+    }
+    return *statements;
+}
+
+void PersonManager::checkSchema(QSqlDatabase &db) const
+{
+    QMutexLocker locker(&m_schemaMutex);
+    if (!m_schemaUpdated) {
+        updateSchema(db);
+        m_schemaUpdated = true;
+    }
+}
+
+PersonVisitor::~PersonVisitor()
+{
+}
+
+void PersonManager::visitPersons(PersonVisitor &visitor) const
+{
+    prepareLookups();
+    {
+        QReadLocker locker(&m_mirrorLock);
+        if (!m_mirrorLoaded) {
+            //the snapshot is ordered by person as well
+            QStringList contactIds;
+            const int count = m_snapshot->count();
+            for (int i = 0; i < count; i++) {
+                const qint64 personId = m_snapshot->personIdAt(i);
+                contactIds << m_snapshot->contactIdAt(i);
+                if (i + 1 == count || m_snapshot->personIdAt(i + 1) != personId) {
+                    visitor.visitPerson(personIdToString(personId), contactIds);
+                    contactIds.clear();
+                }
+            }
+            return;
+        }
+    }
+
+    //rows come sorted by person, so each person is complete once the next one starts
+    QSqlQuery query(threadStatements().database());
+    query.setForwardOnly(true);
+    query.exec("SELECT persons.personId, contacts.source, contacts.localId FROM persons "
+               "JOIN contacts ON contacts.id = persons.contactId ORDER BY persons.personId");
+
+    bool hasPerson = false;
+    qint64 personId = 0;
+    QStringList contactIds;
+    while (query.next()) {
+        const qint64 rowPersonId = query.value(0).toLongLong();
+        if (hasPerson && rowPersonId != personId) {
+            visitor.visitPerson(personIdToString(personId), contactIds);
+            contactIds.clear();
+        }
+        hasPerson = true;
+        personId = rowPersonId;
+        contactIds << joinContactId(query.value(1).toString(), query.value(2).toString());
+    }
+    query.finish();
+
+    if (hasPerson) {
+        visitor.visitPerson(personIdToString(personId), contactIds);
+    }
+}
+
+qint64 PersonManager::lastSequence() const
+{
+    return currentSequence(threadStatements());
+}
+
+qint64 PersonManager::lastAppliedSequence() const
+{
+    QReadLocker locker(&m_mirrorLock);
+    return m_lastSequence;
+}
+
+bool PersonManager::changesSince(qint64 sequence, QList<PersonChange> &changes) const
+{
+    changes.clear();
+    StatementCache &statements = threadStatements();
+
+    //read the range and the changes from the same snapshot
+    Transaction t(statements.database(), Transaction::Read);
+
+    qint64 firstSequence = 0;
+    qint64 lastSequence = 0;
+    QSqlQuery &rangeQuery = statements.query("SELECT MIN(seq), MAX(seq) FROM journal");
+    rangeQuery.exec();
+    if (rangeQuery.next()) {
+        firstSequence = rangeQuery.value(0).toLongLong();
+        lastSequence = rangeQuery.value(1).toLongLong();
+    }
+    rangeQuery.finish();
+
+    //either the database was replaced, or the changes after sequence were compacted away
+    if (sequence > lastSequence || sequence < firstSequence - 1) {
+        return false;
+    }
+
+    QSqlQuery &query = statements.query("SELECT seq, contactId, personId FROM journal WHERE seq > ? ORDER BY seq");
+    query.bindValue(0, sequence);
+    query.exec();
+    while (query.next()) {
+        PersonChange change;
+        change.sequence = query.value(0).toLongLong();
+        change.contactId = query.value(1).toString();
+        if (!query.value(2).isNull()) {
+            change.personId = personIdToString(query.value(2).toLongLong());
+        }
+        changes << change;
+    }
+    query.finish();
+    return true;
+}
+
+void PersonManager::setJournalLimit(int limit)
+{
+    s_journalLimit = limit;
+}
+
+int PersonManager::writeConflicts()
+{
+    return s_writeConflicts;
+}
+
+PersonManager::QueryStatistics PersonManager::queryStatistics(QueryKind kind)
+{
+    QMutexLocker locker(&s_statisticsMutex);
+    return s_statistics[kind];
+}
+
+void PersonManager::resetQueryStatistics()
+{
+    QMutexLocker locker(&s_statisticsMutex);
+    for (int i = 0; i < QueryKindCount; i++) {
+        s_statistics[i] = QueryStatistics();
+    }
+}
+
+void PersonManager::setSlowQueryThreshold(int msecs)
+{
+    s_slowQueryThreshold = qMax(msecs, 0);
+}
+
+
+QString PersonManager::mergeContacts(const QStringList& ids)
+{
+    // no merging if we have only 0 || 1 ids
+    if (ids.size() < 2) {
+        return QString();
+    }
+
+    QueryTimer timer(MergeQuery);
+    StatementCache &statements = threadStatements();
+
+    // start a db transaction, rolled back if anything goes wrong
+    Transaction t(statements.database());
+    if (!t.isActive()) {
+        return QString();
+    }
+
+    QStringList addedContacts;
+    qint64 nextPersonId = firstFreePersonId(statements);
+    const QString personId = writeMerge(statements, ids, nextPersonId, addedContacts);
+    if (!personId.isEmpty()) {
+        compactJournal(statements);
+    }
+    const qint64 sequence = currentSequence(statements);
+    if (personId.isEmpty() || !t.commit()) {
+        t.cancel();
+        return QString();
+    }
+
+    //other processes are told once the snapshot has the merge
+    sendAfterSnapshot(mergeWritten(personId, addedContacts, sequence));
+    return personId;
+}
+
+QStringList PersonManager::mergeContactsBatch(const QList<QStringList> &groups)
+{
+    QueryTimer timer(MergeQuery);
+    StatementCache &statements = threadStatements();
+    QStringList personIds;
+    QList<QStringList> addedContacts;
+    personIds.reserve(groups.size());
+    addedContacts.reserve(groups.size());
+
+    //everything goes into one transaction, a savepoint per group means one failing
+    //group doesn't undo the others, like with queued merges
+    Transaction t(statements.database());
+    if (!t.isActive()) {
+        return QStringList();
+    }
+
+    qint64 nextPersonId = firstFreePersonId(statements);
+    Q_FOREACH (const QStringList &ids, groups) {
+        QStringList groupContacts;
+        statements.query("SAVEPOINT merge").exec();
+        const QString personId = writeMerge(statements, ids, nextPersonId, groupContacts);
+        if (personId.isEmpty()) {
+            statements.query("ROLLBACK TO merge").exec();
+        }
+        statements.query("RELEASE merge").exec();
+
+        personIds << personId;
+        addedContacts << groupContacts;
+    }
+    compactJournal(statements);
+    const qint64 sequence = currentSequence(statements);
+
+    if (!t.commit()) {
+        kWarning() << "Could not commit merges" << statements.database().lastError().text();
+        t.cancel();
+        return QStringList();
+    }
+
+    //a single signal for the whole batch, with the person of every contact in a parallel list
+    QStringList mergedPersonIds;
+    QStringList mergedContactIds;
+    for (int i = 0; i < personIds.size(); i++) {
+        const QString &personId = personIds.at(i);
+        Q_FOREACH (const QString &contactId, addedContacts.at(i)) {
+            mergedPersonIds << personId;
+            mergedContactIds << contactId;
+        }
+    }
+
+    //if someone else wrote since our last change, this catches up on it along with the batch
+    if (advanceSequence(sequence, mergedContactIds.size())) {
+        for (int i = 0; i < personIds.size(); i++) {
+            if (!personIds.at(i).isEmpty() && !addedContacts.at(i).isEmpty()) {
+                applyContactsAdded(personIds.at(i), addedContacts.at(i));
+            }
+        }
+    }
+
+    if (!mergedContactIds.isEmpty()) {
+        QDBusMessage message = QDBusMessage::createSignal(QLatin1String("/KPeople"),
+                                                          QLatin1String("org.kde.KPeople"),
+                                                          QLatin1String("ContactsMerged"));
+
+        message.setArguments(QVariantList() << mergedPersonIds << mergedContactIds << m_origin << sequence);
+
+        QList<QDBusMessage> messages;
+        messages << message;
+        for (int i = 0; i < mergedContactIds.size(); i++) {
+            messages << contactAddedToPersonMessage(mergedContactIds.at(i), mergedPersonIds.at(i));
+        }
+        sendAfterSnapshot(messages);
+    }
+
+    return personIds;
+}
+
+void PersonManager::startWorker()
+{
+    QMutexLocker locker(&m_workerMutex);
+    if (m_workerThread) {
+        return;
+    }
+
+    //makes sure the tables exist before the database thread writes to them
+    threadStatements();
+
+    //not a child, the first write can come from any thread
+    m_workerThread = new QThread();
+    m_worker = new PersonManagerWorker(m_databasePath, m_snapshotPath);
+    m_worker->moveToThread(m_workerThread);
+    connect(m_worker, SIGNAL(mergesWritten()), this, SLOT(onMergesWritten()), Qt::QueuedConnection);
+    m_workerThread->start();
+}
+
+void PersonManager::sendAfterSnapshot(const QList<QDBusMessage> &messages)
+{
+    writeSnapshot();
+    Q_FOREACH (const QDBusMessage &message, messages) {
+        QDBusConnection::sessionBus().send(message);
+    }
+}
+
+void PersonManager::queueMerge(KPeople::MergeContactsJob *job)
+{
+    startWorker();
+
+    PendingMerge merge;
+    merge.id = m_nextMergeId++;
+    merge.sequence = 0;
+    merge.ids = job->ids();
+    m_mergeJobs.insert(merge.id, job);
+
+    //only wake up the worker if it doesn't have a queue to work through already
+    if (m_worker->enqueue(merge)) {
+        QMetaObject::invokeMethod(m_worker, "writePendingMerges", Qt::QueuedConnection);
+    }
+}
+
+void PersonManager::onMergesWritten()
+{
+    const QList<PendingMerge> merges = m_worker->takeWrittenMerges();
+
+    //the worker has already replaced the snapshot, other processes can hear about the merges right away
+    Q_FOREACH (const PendingMerge &merge, merges) {
+        if (!merge.personId.isEmpty()) {
+            Q_FOREACH (const QDBusMessage &message, mergeWritten(merge.personId, merge.addedContacts, merge.sequence)) {
+                QDBusConnection::sessionBus().send(message);
+            }
+        }
+
+        QPointer<KPeople::MergeContactsJob> job = m_mergeJobs.take(merge.id);
+        if (job) {
+            job->finishMerge(merge.personId);
+        }
+    }
+}
+
+QList<QDBusMessage> PersonManager::mergeWritten(const QString &personId, const QStringList &addedContacts, qint64 sequence)
+{
+    QList<QDBusMessage> messages;
+    if (!addedContacts.isEmpty()) {
+        if (advanceSequence(sequence, addedContacts.size())) {
+            applyContactsAdded(personId, addedContacts);
+        }
+
+        QDBusMessage message = QDBusMessage::createSignal(QLatin1String("/KPeople"),
+                                                          QLatin1String("org.kde.KPeople"),
+                                                          QLatin1String("ContactsAddedToPerson"));
+
+        message.setArguments(QVariantList() << personId << addedContacts << m_origin << sequence);
+        messages << message;
+
+        Q_FOREACH (const QString &contactId, addedContacts) {
+            messages << contactAddedToPersonMessage(contactId, personId);
+        }
+    }
+    return messages;
+}
+
+bool PersonManager::unmergeContact(const QString &id)
+{
+    QueryTimer timer(UnmergeQuery);
+    StatementCache &statements = threadStatements();
+    //remove rows from DB
+    const ContactId contactId(id);
+    if (contactId.isPerson()) {
+        const qint64 personId = contactId.personId();
+
+        Transaction t(statements.database());
+        if (!t.isActive()) {
+            return false;
+        }
+
+        //read the contacts inside the transaction, another process might have changed the person
+        QStringList contactIds;
+        QSqlQuery &selectQuery = statements.query("SELECT contacts.source, contacts.localId FROM persons "
+                                                     "JOIN contacts ON contacts.id = persons.contactId WHERE persons.personId = ?");
+        selectQuery.bindValue(0, personId);
+        selectQuery.exec();
+        while (selectQuery.next()) {
+            contactIds << joinContactId(selectQuery.value(0).toString(), selectQuery.value(1).toString());
+        }
+        selectQuery.finish();
+
+        QSqlQuery &contactsQuery = statements.query("DELETE FROM contacts WHERE id IN (SELECT contactId FROM persons WHERE personId = ?)");
+        contactsQuery.bindValue(0, personId);
+        contactsQuery.exec();
+
+        QSqlQuery &query = statements.query("DELETE FROM persons WHERE personId = ?");
+        query.bindValue(0, personId);
+        query.exec();
+
+        writeJournal(statements, contactIds, -1);
+        compactJournal(statements);
+        const qint64 sequence = currentSequence(statements);
+        if (!t.commit()) {
+            return false;
+        }
+
+        if (!contactIds.isEmpty()) {
+            sendAfterSnapshot(contactsUnmerged(contactIds, sequence));
+        }
+    } else {
+        const QString source = contactId.source();
+        const QString localId = contactId.localId();
+
+        Transaction t(statements.database());
+        if (!t.isActive()) {
+            return false;
+        }
+
+        QSqlQuery &query = statements.query("DELETE FROM persons WHERE contactId = (SELECT id FROM contacts WHERE source = ? AND localId = ?)");
+        query.bindValue(0, source);
+        query.bindValue(1, localId);
+        query.exec();
+
+        QSqlQuery &contactsQuery = statements.query("DELETE FROM contacts WHERE source = ? AND localId = ?");
+        contactsQuery.bindValue(0, source);
+        contactsQuery.bindValue(1, localId);
+        contactsQuery.exec();
+
+        writeJournal(statements, QStringList() << id, -1);
+        compactJournal(statements);
+        const qint64 sequence = currentSequence(statements);
+        if (!t.commit()) {
+            return false;
+        }
+
+        sendAfterSnapshot(contactsUnmerged(QStringList() << id, sequence));
+    }
+
+    return true;
+}
+
+QList<QDBusMessage> PersonManager::contactsUnmerged(const QStringList &contactIds, qint64 sequence)
+{
+    if (advanceSequence(sequence, contactIds.size())) {
+        applyContactsRemoved(contactIds);
+    }
+
+    QDBusMessage message = QDBusMessage::createSignal(QLatin1String("/KPeople"),
+                                                      QLatin1String("org.kde.KPeople"),
+                                                      QLatin1String("ContactsRemovedFromPerson"));
+
+    message.setArguments(QVariantList() << contactIds << m_origin << sequence);
+
+    QList<QDBusMessage> messages;
+    messages << message;
+    Q_FOREACH (const QString &contactId, contactIds) {
+        QDBusMessage legacyMessage = QDBusMessage::createSignal(QLatin1String("/KPeople"),
+                                                                QLatin1String("org.kde.KPeople"),
+                                                                QLatin1String("ContactRemovedFromPerson"));
+        legacyMessage.setArguments(QVariantList() << contactId);
+        messages << legacyMessage;
+    }
+    return messages;
+}
+
+PersonManager* PersonManager::instance(const QString &databasePath)
+{
+    static QMutex s_instanceMutex;
+    static PersonManager* s_instance = 0;
+
+    QMutexLocker locker(&s_instanceMutex);
+    if (!s_instance) {
+        QString path = databasePath;
+        if (path.isEmpty()) {
+            path = KGlobal::dirs()->locateLocal("data","kpeople/persondb");
+        }
+        s_instance = new PersonManager(path);
+
+        //D-Bus signals are delivered through the event loop of the main thread,
+        //a worker thread asking first might not even have one
+        if (QCoreApplication::instance() && s_instance->thread() != QCoreApplication::instance()->thread()) {
+            s_instance->moveToThread(QCoreApplication::instance()->thread());
         }
-        s_instance = new PersonManager(path);
     }
     return s_instance;
 }
@@ -27,15 +27,59 @@
 
 #include <QSqlDatabase>
 #include <QSqlQuery>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QThreadStorage>
+#include <QPointer>
+#include <QSet>
+#include <QDBusMessage>
 
 #include "kpeople_export.h"
 
+class QThread;
+class QDBusServiceWatcher;
+class StatementCache;
+class PersonSnapshot;
+class PersonManagerWorker;
+
+namespace KPeople {
+class MergeContactsJob;
+}
+
+/**
+ * A single entry of the change journal in the database
+ */
+struct PersonChange
+{
+    //increases with every change, clients remember the last one they applied
+    qint64 sequence;
+    QString contactId;
+    //the person the contact was moved into, or empty if it is no longer part of any person
+    QString personId;
+};
+
+/**
+ * Receives the persons stored in the database one at a time, see PersonManager::visitPersons()
+ */
+class KPEOPLE_EXPORT PersonVisitor
+{
+public:
+    virtual ~PersonVisitor();
+    virtual void visitPerson(const QString &personId, const QStringList &contactIds) = 0;
+};
+
 /**
  * This is a private internal class that manages all the internal mapping of contacts <---> persons
  * It stores the connection to the database as well as signals communicating with other clients
  *
  * It is a singleton.
  *
+ * Lookups, merges and unmerges can be used from any thread, every thread gets its own
+ * connection to the database. Merge jobs and the signals belong to the main thread.
+ *
+ * Lookups are answered from a memory-mapped snapshot shared by all processes, the
+ * database is only opened when there is no snapshot yet, the snapshot is older than the
+ * database files, a missed change has to be read from the journal or something is written.
  */
 
 class KPEOPLE_EXPORT PersonManager : public QObject
@@ -57,6 +101,13 @@ public:
     /** Retuns a list of all known personIDs in the database*/
     QMultiHash< QString /*PersonID*/, QString /*ContactId*/> allPersons() const;
 
+    /**
+     * Calls @p visitor once for every person in the database, with all of its contacts.
+     * The persons are read straight from the database in a single pass, without
+     * building a container of all of them first.
+     */
+    void visitPersons(PersonVisitor &visitor) const;
+
     /**
      * Returns the ID of a person associated with a given contact
      * If no person for that contact exists, an empty string is returned
@@ -68,6 +119,73 @@ public:
      */
     QStringList contactsForPersonId(const QString &personId) const;
 
+    //all of the above are answered from the snapshot, or from an in-memory mirror of the
+    //database loaded on first use when the snapshot can't be used
+
+    /**
+     * Returns the sequence number of the last change written to the database, or 0 if there is none
+     */
+    qint64 lastSequence() const;
+
+    /**
+     * Fills @p changes with all changes made after @p sequence, oldest first.
+     *
+     * @return false if the journal no longer reaches back to @p sequence, the client
+     * then has to start over from allPersons()
+     */
+    bool changesSince(qint64 sequence, QList<PersonChange> &changes) const;
+
+    /**
+     * Sets how many changes the journal keeps, older ones are dropped with the next write.
+     * A limit of 0 or less keeps all changes. The default is 10000.
+     */
+    static void setJournalLimit(int limit);
+
+    /**
+     * Returns the sequence of the last change this instance has applied, with all changes before it
+     * applied as well. A client which stores it can later catch up from it with changesSince()
+     */
+    qint64 lastAppliedSequence() const;
+
+    /**
+     * Returns how many write transactions of this process had to wait for another
+     * writer to release the database lock, including those which gave up waiting
+     */
+    static int writeConflicts();
+
+//STATISTICS------------
+
+    enum QueryKind {
+        AllPersonsQuery,
+        PersonIdForContactQuery,
+        ContactsForPersonIdQuery,
+        MergeQuery,         ///< merges, batches of merges and groups written by the database thread
+        UnmergeQuery,
+        CommitQuery,        ///< committing write transactions, also part of merges and unmerges
+        QueryKindCount
+    };
+
+    /** How long the calls of a kind took, in microseconds */
+    struct QueryStatistics
+    {
+        QueryStatistics() : count(0), totalTime(0), maxTime(0) {}
+        int count;
+        qint64 totalTime;
+        qint64 maxTime;
+    };
+
+    /**
+     * Returns the statistics of @p kind in this process since it started
+     * or since the last resetQueryStatistics()
+     */
+    static QueryStatistics queryStatistics(QueryKind kind);
+    static void resetQueryStatistics();
+
+    /**
+     * Calls taking longer than @p msecs are logged as warnings.
+     * The default is 100, or the value of the KPEOPLE_SLOW_QUERY_MS environment variable
+     */
+    static void setSlowQueryThreshold(int msecs);
 
 public Q_SLOTS:
     //merge all ids (person IDs and contactIds into a single person)
@@ -75,20 +193,209 @@ public Q_SLOTS:
     //users should KPeople::mergeContacts from global.h
     QString mergeContacts(const QStringList &ids);
 
+    //merge every list of ids in @p groups into its own person, all in a single transaction
+    //returns the person ID for each group, empty for groups which could not be merged
+    //users should KPeople::mergeContactsBatch from global.h
+    QStringList mergeContactsBatch(const QList<QStringList> &groups);
+
     //unmerge a contact. Either remove a contact from a given person or remove a person
     //users should KPeople::unmergeContact from global.h
     bool unmergeContact(const QString &id);
 
+public:
+    /**
+     * Queue the merge of @p job to be written by the database thread.
+     * The job is finished once the merge has been committed.
+     * Users should use KPeople::MergeContactsJob
+     */
+    void queueMerge(KPeople::MergeContactsJob *job);
+
 Q_SIGNALS:
-    void contactRemovedFromPerson(const QString &contactId);
-    void contactAddedToPerson(const QString &contactId, const QString &newPersonId);
+    /**
+     * Emitted when contacts are no longer part of any person.
+     * All contacts removed by a single unmerge are reported in one signal
+     */
+    void contactsRemovedFromPerson(const QStringList &contactIds);
+
+    /**
+     * Emitted when contacts are moved into the person @p newPersonId.
+     * All contacts affected by a single merge are reported in one signal
+     */
+    void contactsAddedToPerson(const QString &newPersonId, const QStringList &contactIds);
 
 protected:
     explicit PersonManager(const QString &databasePath, QObject* parent = 0);
     virtual ~PersonManager();
 
+private Q_SLOTS:
+    //changes from other clients, sent over D-Bus
+    //every signal carries the bus name of the sender and the journal sequence of the change
+    void onContactsAddedToPerson(const QString &newPersonId, const QStringList &contactIds, const QString &origin, qlonglong sequence);
+    void onContactsRemovedFromPerson(const QStringList &contactIds, const QString &origin, qlonglong sequence);
+    void onContactsMerged(const QStringList &personIds, const QStringList &contactIds, const QString &origin, qlonglong sequence);
+
+    //the signals of older clients, which announce every contact on its own and don't write the journal
+    void onContactAddedToPerson(const QString &contactId, const QString &newPersonId, const QDBusMessage &message);
+    void onContactRemovedFromPerson(const QString &contactId, const QDBusMessage &message);
+
+    //a client in m_batchingClients left the bus, its name is never used again
+    void onBatchingClientGone(const QString &origin);
+
+    //the database thread committed merges queued with queueMerge()
+    void onMergesWritten();
+
+private:
+    //apply a committed merge locally, returns the signals which tell all other clients about it
+    QList<QDBusMessage> mergeWritten(const QString &personId, const QStringList &addedContacts, qint64 sequence);
+
+    //apply a committed unmerge locally, returns the signals which tell all other clients about it
+    QList<QDBusMessage> contactsUnmerged(const QStringList &contactIds, qint64 sequence);
+
+    //replaces the snapshot and then sends @p messages, so that other processes find the change
+    //in the snapshot when they hear of it; done before the blocking writes return, so a
+    //process which exits right after them has still told everyone
+    void sendAfterSnapshot(const QList<QDBusMessage> &messages);
+    void startWorker();
+
+    //update the mirror and emit the Qt signals for a change
+    void applyContactsAdded(const QString &newPersonId, const QStringList &contactIds);
+    void applyContactsRemoved(const QStringList &contactIds);
+
+    //whether a D-Bus signal is one we sent ourselves, and so already applied
+    bool isEcho(const QString &origin) const;
+    //remembers that @p origin sends batched signals, until it leaves the bus
+    void addBatchingClient(const QString &origin);
+
+    /**
+     * Moves the last applied sequence to @p sequence, the end of a change with @p changeCount
+     * journal entries. If changes were missed in between, they are replayed from the journal first.
+     *
+     * @return true if the caller has to apply the change, false if it already was
+     */
+    bool advanceSequence(qint64 sequence, int changeCount);
+
+    //applies all changes in the journal after @p sequence, false if they're no longer all there
+    bool replayChanges(qint64 sequence);
+    void setLastSequence(qint64 sequence);
+
+    //the prepared statements of the calling thread, on its own connection
+    StatementCache& threadStatements() const;
+
+    //creates or updates the tables, once per process
+    void checkSchema(QSqlDatabase &db) const;
+
+    //lookups are answered from the snapshot if there is one, or else from the mirror
+    void prepareLookups() const;
+
+    //replaces the snapshot with the current state of the database, for when there was no usable
+    //one and after the blocking writes; the database thread does this for queued merges
+    void writeSnapshot() const;
+
+    //the mirror is a copy of the persons table in both directions, loaded once
+    //and then kept in sync with our own writes and the D-Bus signals
+    void loadMirror() const;
+    void mirrorAddContacts(const QString &personId, const QStringList &contactIds);
+    void mirrorRemoveContacts(const QStringList &contactIds);
+
+    QString m_databasePath;
+    //opened on first use
+    mutable QSqlDatabase m_db;
+    //only used in the thread of the instance, all other threads use m_threadStatements
+    mutable StatementCache *m_statements;
+    mutable QThreadStorage<StatementCache*> m_threadStatements;
+    mutable QMutex m_schemaMutex;
+    mutable bool m_schemaUpdated;
+
+    //the database thread and its connection are only created for the first write
+    QMutex m_workerMutex;
+    QThread *m_workerThread;
+    PersonManagerWorker *m_worker;
+    int m_nextMergeId;
+    QHash<int, QPointer<KPeople::MergeContactsJob> > m_mergeJobs;
+
+    //our unique name on the session bus, sent along with our signals
+    QString m_origin;
+    //the last journal entry applied without a gap before it, set from the snapshot or
+    //the mirror when they are loaded, 0 until then
+    mutable qint64 m_lastSequence;
+    //serializes advanceSequence(), so a gap is only replayed once; recursive as the
+    //signals emitted while replaying may write again
+    QMutex m_sequenceMutex;
+    //the clients which sent batched signals, their per-contact signals are duplicates
+    QSet<QString> m_batchingClients;
+    QDBusServiceWatcher *m_batchingClientWatcher;
+
+    QString m_snapshotPath;
+    PersonSnapshot *m_snapshot;
+    //set when the database changed after the snapshot was mapped
+    mutable bool m_snapshotStale;
+
+    //guards the snapshot, the mirror and m_lastSequence
+    mutable QReadWriteLock m_mirrorLock;
+    mutable bool m_mirrorLoaded;
+    mutable QHash<QString /*ContactId*/, QString /*PersonId*/> m_contactToPerson;
+    mutable QHash<QString /*PersonId*/, QStringList /*ContactIds*/> m_personToContacts;
+};
+
+/**
+ * A merge queued to be written by the database thread
+ */
+struct PendingMerge
+{
+    int id;
+    QStringList ids;
+
+    //set by the database thread once written
+    QString personId;
+    QStringList addedContacts;
+    qint64 sequence;
+};
+
+/**
+ * Writes queued merges on a separate thread with its own database connection.
+ *
+ * Merges queued while a group is being written are committed together in the next transaction.
+ * The snapshot is replaced there as well after every write, before other processes are told about it
+ */
+class PersonManagerWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    PersonManagerWorker(const QString &databasePath, const QString &snapshotPath);
+    virtual ~PersonManagerWorker();
+
+    /**
+     * Add a merge to the queue. Can be called from any thread.
+     * @return true if the queue was empty, in which case writePendingMerges() has to be invoked
+     */
+    bool enqueue(const PendingMerge &merge);
+
+    /**
+     * Returns all merges written since the last call. Can be called from any thread.
+     */
+    QList<PendingMerge> takeWrittenMerges();
+
+public Q_SLOTS:
+    void writePendingMerges();
+
+    //closes and removes the connection, has to be invoked in the worker thread before it quits
+    void closeDatabase();
+
+Q_SIGNALS:
+    void mergesWritten();
+
 private:
+    void openConnection();
+
+    QString m_databasePath;
+    QString m_snapshotPath;
     QSqlDatabase m_db;
+    StatementCache *m_statements;
+
+    QMutex m_mutex;
+    QList<PendingMerge> m_pendingMerges;
+    QList<PendingMerge> m_writtenMerges;
 };
 
 #endif // PERSONMANAGER_H
@@ -19,115 +19,469 @@
 
 #include "personpluginmanager_p.h"
 #include "basepersonsdatasource.h"
+#include "contactid_p.h"
 
 #include "abstractpersonaction.h"
 
 #include <KService>
 #include <KServiceTypeTrader>
 #include <KPluginInfo>
+#include <KPluginLoader>
+#include <KPluginFactory>
 #include <KDebug>
 
 #include <QMutex>
+#include <QAtomicPointer>
+#include <QElapsedTimer>
+#include <QVector>
 
 #include <kdemacros.h>
 
+#include <stdio.h>
+
 using namespace KPeople;
 
+PluginLoadTiming::PluginLoadTiming():
+    queryTime(0),
+    libraryLoadTime(0),
+    factoryTime(0),
+    constructorTime(0),
+    loaded(false)
+{
+}
+
+namespace {
+struct PluginLoadTimings
+{
+    QMutex mutex;
+    QList<PluginLoadTiming> timings;
+};
+}
+
+K_GLOBAL_STATIC(PluginLoadTimings, s_pluginLoadTimings);
+
+static void recordPluginLoadTiming(const PluginLoadTiming &timing)
+{
+    //asked for explicitly, so straight to stderr where no debug setting or build type can hide it
+    static const bool report = !qgetenv("KPEOPLE_PLUGIN_PROFILE").isEmpty();
+    if (report) {
+        if (timing.plugin.isEmpty()) {
+            fprintf(stderr, "kpeople: querying %s took %lld us\n",
+                    qPrintable(timing.serviceType), timing.queryTime);
+        } else {
+            fprintf(stderr, "kpeople: loading %s %s %s %lld us in the library, %lld us in the factory and %lld us in the constructor\n",
+                    qPrintable(timing.serviceType), qPrintable(timing.plugin), timing.loaded ? "took" : "failed after",
+                    timing.libraryLoadTime, timing.factoryTime, timing.constructorTime);
+        }
+    }
+
+    QMutexLocker locker(&s_pluginLoadTimings->mutex);
+    s_pluginLoadTimings->timings << timing;
+}
+
+/**
+ * The loaded plugins. A registry is never changed once it is published, loading
+ * plugins publishes a modified copy, so readers don't need to lock anything.
+ */
+class PluginRegistry
+{
+public:
+    PluginRegistry();
+
+    QList<AbstractPersonAction*> actionPlugins;
+    //a source can be in here twice, under its ID and the one its desktop file claims
+    QHash<QString /* SourceName*/, BasePersonsDataSource*> dataSourcePlugins;
+    //every loaded data source once, so readers get them without building a list
+    QList<BasePersonsDataSource*> dataSourcePluginList;
+    //dataSourcePlugins by the interned ContactId source index, null for sources not loaded
+    QVector<BasePersonsDataSource*> dataSourcesByIndex;
+
+    //the services of all data sources, indexed by the X-KPeople-SourcePluginId key of their
+    //desktop file so that only the ones actually used get instantiated
+    QHash<QString /* SourceName*/, KService::Ptr> dataSourceServices;
+    //data sources without the key, we only know their ID once they are instantiated
+    KService::List unindexedDataSourceServices;
+
+    bool queriedDataSourceServices;
+    bool loadedUnindexedDataSourcePlugins;
+    bool loadedDataSourcePlugins;
+    bool loadedActionsPlugins;
+};
+
+PluginRegistry::PluginRegistry():
+    queriedDataSourceServices(false),
+    loadedUnindexedDataSourcePlugins(false),
+    loadedDataSourcePlugins(false),
+    loadedActionsPlugins(false)
+{
+}
+
 class PersonPluginManagerPrivate
 {
 public:
     PersonPluginManagerPrivate();
     ~PersonPluginManagerPrivate();
-    QList<AbstractPersonAction*> actionPlugins;
-    QHash<QString /* SourceName*/, BasePersonsDataSource*> dataSourcePlugins;
 
-    void loadDataSourcePlugins();
-    void loadActionsPlugins();
-    bool m_loadedDataSourcePlugins;
-    bool m_loadedActionsPlugins;
-    QMutex m_mutex;
+    //the registry seen by readers, always read it through currentRegistry()
+    QAtomicPointer<PluginRegistry> registry;
+    //registries which have been replaced, readers might still be using them
+    QList<PluginRegistry*> retiredRegistries;
+    //plugins replaced by setDataSourcePlugins() and setActionPlugins(), the retired registries
+    //still point to them
+    QList<BasePersonsDataSource*> retiredDataSources;
+    QList<AbstractPersonAction*> retiredActionPlugins;
+
+    //the published registry, with everything written to it before it was published visible
+    const PluginRegistry* currentRegistry();
 
+    //all of these change an unpublished copy of the registry and must be called with m_mutex held
+    PluginRegistry* copyRegistry();
+    void publish(PluginRegistry *newRegistry);
+    void addDataSource(PluginRegistry *registry, const QString &sourceId, BasePersonsDataSource *dataSource);
+    void indexDataSource(PluginRegistry *registry, const QString &sourceId, BasePersonsDataSource *dataSource);
+    void queryDataSourceServices(PluginRegistry *registry);
+    void loadDataSource(PluginRegistry *registry, const KService::Ptr &service);
+    void loadUnindexedDataSourcePlugins(PluginRegistry *registry);
+    void loadDataSourcePlugins(PluginRegistry *registry);
+    void loadActionsPlugins(PluginRegistry *registry);
+
+    //serializes loading plugins, never taken for reading
+    QMutex m_mutex;
 };
 
 K_GLOBAL_STATIC(PersonPluginManagerPrivate, s_instance);
 
 PersonPluginManagerPrivate::PersonPluginManagerPrivate():
-    m_loadedDataSourcePlugins(false),
-    m_loadedActionsPlugins(false)
+    registry(new PluginRegistry)
 {
 }
 
 PersonPluginManagerPrivate::~PersonPluginManagerPrivate()
 {
-    qDeleteAll(dataSourcePlugins);
-    qDeleteAll(actionPlugins);
+    PluginRegistry *lastRegistry = registry.fetchAndAddAcquire(0);
+    qDeleteAll(lastRegistry->dataSourcePluginList);
+    qDeleteAll(lastRegistry->actionPlugins);
+    delete lastRegistry;
+    qDeleteAll(retiredRegistries);
+    qDeleteAll(retiredDataSources);
+    qDeleteAll(retiredActionPlugins);
+}
+
+const PluginRegistry* PersonPluginManagerPrivate::currentRegistry()
+{
+    //Qt 4 has no loadAcquire(), adding nothing is the same with acquire semantics
+    return registry.fetchAndAddAcquire(0);
+}
+
+PluginRegistry* PersonPluginManagerPrivate::copyRegistry()
+{
+    return new PluginRegistry(*currentRegistry());
+}
+
+void PersonPluginManagerPrivate::publish(PluginRegistry *newRegistry)
+{
+    //the old registry is kept around, it's small and plugins are only loaded a few times
+    retiredRegistries << registry.fetchAndStoreOrdered(newRegistry);
+}
+
+void PersonPluginManagerPrivate::addDataSource(PluginRegistry *registry, const QString &sourceId, BasePersonsDataSource *dataSource)
+{
+    registry->dataSourcePluginList << dataSource;
+    indexDataSource(registry, sourceId, dataSource);
+}
+
+void PersonPluginManagerPrivate::indexDataSource(PluginRegistry *registry, const QString &sourceId, BasePersonsDataSource *dataSource)
+{
+    registry->dataSourcePlugins.insert(sourceId, dataSource);
+
+    const int index = ContactId::registerSource(sourceId);
+    if (index >= registry->dataSourcesByIndex.size()) {
+        registry->dataSourcesByIndex.resize(index + 1);
+    }
+    registry->dataSourcesByIndex[index] = dataSource;
 }
 
-void PersonPluginManagerPrivate::loadDataSourcePlugins()
+void PersonPluginManagerPrivate::queryDataSourceServices(PluginRegistry *registry)
 {
-    KService::List pluginList = KServiceTypeTrader::self()->query(QLatin1String("KPeople/DataSource"));
+    //only reads the sycoca, no plugin library is loaded here
+    KService::List pluginList = PersonPluginManager::queryServices(QLatin1String("KPeople/DataSource"));
     Q_FOREACH(const KService::Ptr &service, pluginList) {
-        BasePersonsDataSource* dataSource = service->createInstance<BasePersonsDataSource>(0);
-        if (dataSource) {
-            dataSourcePlugins[dataSource->sourcePluginId()] = dataSource;
+        const QString sourceId = service->property(QLatin1String("X-KPeople-SourcePluginId"), QVariant::String).toString();
+        if (sourceId.isEmpty()) {
+            registry->unindexedDataSourceServices << service;
         } else {
-            kWarning() << "Failed to create data source " << service->name() << service->path();
+            registry->dataSourceServices.insert(sourceId, service);
         }
     }
-    m_loadedDataSourcePlugins = true;
+    registry->queriedDataSourceServices = true;
 }
 
-void PersonPluginManagerPrivate::loadActionsPlugins()
+void PersonPluginManagerPrivate::loadDataSource(PluginRegistry *registry, const KService::Ptr &service)
 {
-    KService::List personPluginList = KServiceTypeTrader::self()->query(QLatin1String("KPeople/Plugin"));
+    const QString indexedId = service->property(QLatin1String("X-KPeople-SourcePluginId"), QVariant::String).toString();
+
+    //createPluginInstance() has already said why if this fails
+    QObject *instance = PersonPluginManager::createPluginInstance(service, 0);
+    BasePersonsDataSource* dataSource = qobject_cast<BasePersonsDataSource*>(instance);
+    if (!dataSource) {
+        if (instance) {
+            kWarning() << service->path() << "is not a data source";
+            delete instance;
+        }
+        //don't try again for every contact of that source
+        registry->dataSourceServices.remove(indexedId);
+        return;
+    }
+
+    const QString sourceId = dataSource->sourcePluginId();
+    if (registry->dataSourcePlugins.contains(sourceId)) {
+        kWarning() << "Data source" << sourceId << "is provided by more than one plugin, ignoring" << service->path();
+        delete dataSource;
+        return;
+    }
+
+    addDataSource(registry, sourceId, dataSource);
+
+    //register it under the ID it was looked up by as well, or every lookup of that
+    //ID would load the plugin again
+    if (!indexedId.isEmpty() && indexedId != sourceId) {
+        kWarning() << service->path() << "says it provides" << indexedId << "but provides" << sourceId;
+        if (!registry->dataSourcePlugins.contains(indexedId)) {
+            indexDataSource(registry, indexedId, dataSource);
+        }
+    }
+}
+
+void PersonPluginManagerPrivate::loadUnindexedDataSourcePlugins(PluginRegistry *registry)
+{
+    if (!registry->queriedDataSourceServices) {
+        queryDataSourceServices(registry);
+    }
+    Q_FOREACH(const KService::Ptr &service, registry->unindexedDataSourceServices) {
+        loadDataSource(registry, service);
+    }
+    registry->unindexedDataSourceServices.clear();
+    registry->loadedUnindexedDataSourcePlugins = true;
+}
+
+void PersonPluginManagerPrivate::loadDataSourcePlugins(PluginRegistry *registry)
+{
+    if (!registry->queriedDataSourceServices) {
+        queryDataSourceServices(registry);
+    }
+    //loadDataSource() can remove services which fail to load, so go through a copy
+    const QHash<QString, KService::Ptr> services = registry->dataSourceServices;
+    QHash<QString, KService::Ptr>::const_iterator it = services.constBegin();
+    for (; it != services.constEnd(); ++it) {
+        if (!registry->dataSourcePlugins.contains(it.key())) {
+            loadDataSource(registry, it.value());
+        }
+    }
+    if (!registry->loadedUnindexedDataSourcePlugins) {
+        loadUnindexedDataSourcePlugins(registry);
+    }
+    registry->loadedDataSourcePlugins = true;
+}
+
+void PersonPluginManagerPrivate::loadActionsPlugins(PluginRegistry *registry)
+{
+    KService::List personPluginList = PersonPluginManager::queryServices(QLatin1String("KPeople/Plugin"));
     Q_FOREACH(const KService::Ptr &service, personPluginList) {
-        AbstractPersonAction *plugin = service->createInstance<AbstractPersonAction>(0);
+        QObject *instance = PersonPluginManager::createPluginInstance(service, 0);
+        AbstractPersonAction *plugin = qobject_cast<AbstractPersonAction*>(instance);
         if (plugin) {
             qDebug() << "found plugin" << service->name();
-            actionPlugins << plugin;
+            registry->actionPlugins << plugin;
+        } else {
+            delete instance;
         }
     }
-    m_loadedActionsPlugins = true;
+    registry->loadedActionsPlugins = true;
 }
 
 void PersonPluginManager::setDataSourcePlugins(const QHash<QString, BasePersonsDataSource* > &dataSources)
 {
-    s_instance->m_mutex.lock();
-    qDeleteAll(s_instance->dataSourcePlugins);
-    s_instance->dataSourcePlugins.clear();
-    s_instance->dataSourcePlugins = dataSources;
-    s_instance->m_loadedDataSourcePlugins = true;
-    s_instance->m_mutex.unlock();
+    QMutexLocker locker(&s_instance->m_mutex);
+    PluginRegistry *newRegistry = s_instance->copyRegistry();
+    //readers might still use the old sources through the registry they got before, so they
+    //are only deleted along with the retired registries
+    const QList<BasePersonsDataSource*> newDataSources = dataSources.values();
+    Q_FOREACH (BasePersonsDataSource *dataSource, newRegistry->dataSourcePluginList) {
+        if (!newDataSources.contains(dataSource) && !s_instance->retiredDataSources.contains(dataSource)) {
+            s_instance->retiredDataSources << dataSource;
+        }
+    }
+    newRegistry->dataSourcePlugins.clear();
+    newRegistry->dataSourcePluginList.clear();
+    newRegistry->dataSourcesByIndex.clear();
+    QHash<QString, BasePersonsDataSource*>::const_iterator it = dataSources.constBegin();
+    for (; it != dataSources.constEnd(); ++it) {
+        s_instance->addDataSource(newRegistry, it.key(), it.value());
+    }
+    newRegistry->loadedDataSourcePlugins = true;
+    s_instance->publish(newRegistry);
+}
+
+void PersonPluginManager::setActionPlugins(const QList<AbstractPersonAction*> &actionPlugins)
+{
+    QMutexLocker locker(&s_instance->m_mutex);
+    PluginRegistry *newRegistry = s_instance->copyRegistry();
+    Q_FOREACH (AbstractPersonAction *plugin, newRegistry->actionPlugins) {
+        if (!actionPlugins.contains(plugin) && !s_instance->retiredActionPlugins.contains(plugin)) {
+            s_instance->retiredActionPlugins << plugin;
+        }
+    }
+    newRegistry->actionPlugins = actionPlugins;
+    newRegistry->loadedActionsPlugins = true;
+    s_instance->publish(newRegistry);
 }
 
 QList<BasePersonsDataSource*> PersonPluginManager::dataSourcePlugins()
 {
-    s_instance->m_mutex.lock();
-    if (!s_instance->m_loadedDataSourcePlugins) {
-        s_instance->loadDataSourcePlugins();
+    const PluginRegistry *registry = s_instance->currentRegistry();
+    if (registry->loadedDataSourcePlugins) {
+        return registry->dataSourcePluginList;
+    }
+
+    QMutexLocker locker(&s_instance->m_mutex);
+    //another thread might have loaded them while we waited for the lock
+    registry = s_instance->currentRegistry();
+    if (!registry->loadedDataSourcePlugins) {
+        PluginRegistry *newRegistry = s_instance->copyRegistry();
+        s_instance->loadDataSourcePlugins(newRegistry);
+        s_instance->publish(newRegistry);
+        registry = newRegistry;
     }
-    s_instance->m_mutex.unlock();
-    return s_instance->dataSourcePlugins.values();
+    return registry->dataSourcePluginList;
 }
 
 BasePersonsDataSource* PersonPluginManager::dataSource(const QString &sourceId)
 {
-    s_instance->m_mutex.lock();
-    if (!s_instance->m_loadedDataSourcePlugins) {
-        s_instance->loadDataSourcePlugins();
+    const PluginRegistry *registry = s_instance->currentRegistry();
+    BasePersonsDataSource *dataSource = registry->dataSourcePlugins.value(sourceId);
+
+    //nothing left which could provide this source
+    const bool unknownSource = registry->loadedUnindexedDataSourcePlugins &&
+                               !registry->dataSourceServices.contains(sourceId);
+    if (dataSource || registry->loadedDataSourcePlugins || unknownSource) {
+        return dataSource;
     }
-    s_instance->m_mutex.unlock();
 
-    return s_instance->dataSourcePlugins[sourceId];
+    QMutexLocker locker(&s_instance->m_mutex);
+    registry = s_instance->currentRegistry();
+    dataSource = registry->dataSourcePlugins.value(sourceId);
+    if (dataSource || registry->loadedDataSourcePlugins) {
+        return dataSource;
+    }
+
+    //only instantiate the plugin providing this source
+    PluginRegistry *newRegistry = s_instance->copyRegistry();
+    if (!newRegistry->queriedDataSourceServices) {
+        s_instance->queryDataSourceServices(newRegistry);
+    }
+    const KService::Ptr service = newRegistry->dataSourceServices.value(sourceId);
+    if (service) {
+        s_instance->loadDataSource(newRegistry, service);
+        dataSource = newRegistry->dataSourcePlugins.value(sourceId);
+    }
+
+    //plugins without the desktop file key could provide it as well
+    if (!dataSource && !newRegistry->loadedUnindexedDataSourcePlugins) {
+        s_instance->loadUnindexedDataSourcePlugins(newRegistry);
+        dataSource = newRegistry->dataSourcePlugins.value(sourceId);
+    }
+
+    s_instance->publish(newRegistry);
+    return dataSource;
+}
+
+BasePersonsDataSource* PersonPluginManager::dataSource(const ContactId &contactId)
+{
+    const int index = contactId.sourceIndex();
+    if (index < 0) {
+        //the source isn't interned before its data source is loaded
+        return contactId.source().isEmpty() ? 0 : PersonPluginManager::dataSource(contactId.source());
+    }
+
+    const PluginRegistry *registry = s_instance->currentRegistry();
+    BasePersonsDataSource *dataSource = registry->dataSourcesByIndex.value(index);
+    if (dataSource || registry->loadedDataSourcePlugins) {
+        return dataSource;
+    }
+    //not loaded yet, or a source nothing provides
+    return PersonPluginManager::dataSource(contactId.source());
 }
 
 QList<AbstractPersonAction*> PersonPluginManager::actions()
 {
-    s_instance->m_mutex.lock();
-    if (!s_instance->m_loadedActionsPlugins) {
-        s_instance->loadActionsPlugins();
+    const PluginRegistry *registry = s_instance->currentRegistry();
+    if (registry->loadedActionsPlugins) {
+        return registry->actionPlugins;
     }
-    s_instance->m_mutex.unlock();
 
-    return s_instance->actionPlugins;
+    QMutexLocker locker(&s_instance->m_mutex);
+    registry = s_instance->currentRegistry();
+    if (!registry->loadedActionsPlugins) {
+        PluginRegistry *newRegistry = s_instance->copyRegistry();
+        s_instance->loadActionsPlugins(newRegistry);
+        s_instance->publish(newRegistry);
+        registry = newRegistry;
+    }
+    return registry->actionPlugins;
+}
+
+QList<PluginLoadTiming> PersonPluginManager::pluginLoadTimings()
+{
+    QMutexLocker locker(&s_pluginLoadTimings->mutex);
+    return s_pluginLoadTimings->timings;
+}
+
+KService::List PersonPluginManager::queryServices(const QString &serviceType)
+{
+    PluginLoadTiming timing;
+    timing.serviceType = serviceType;
+
+    QElapsedTimer timer;
+    timer.start();
+    const KService::List services = KServiceTypeTrader::self()->query(serviceType);
+    timing.queryTime = timer.nsecsElapsed() / 1000;
+    timing.loaded = true;
+
+    recordPluginLoadTiming(timing);
+    return services;
+}
+
+QObject* PersonPluginManager::createPluginInstance(const KService::Ptr &service, QObject *parent,
+                                                   const QVariantList &args)
+{
+    PluginLoadTiming timing;
+    timing.serviceType = service->serviceTypes().value(0);
+    timing.plugin = service->library();
+
+    //the same steps as KService::createInstance(), timed one by one
+    QElapsedTimer timer;
+    timer.start();
+    KPluginLoader loader(*service);
+    const bool libraryLoaded = loader.load();
+    timing.libraryLoadTime = timer.nsecsElapsed() / 1000;
+
+    QObject *instance = 0;
+    if (libraryLoaded) {
+        timer.restart();
+        KPluginFactory *factory = loader.factory();
+        timing.factoryTime = timer.nsecsElapsed() / 1000;
+
+        if (factory) {
+            timer.restart();
+            instance = factory->create<QObject>(service->pluginKeyword(), parent, args);
+            timing.constructorTime = timer.nsecsElapsed() / 1000;
+        }
+    }
+
+    if (!instance) {
+        kWarning() << "Could not load plugin" << service->name() << loader.errorString();
+    }
+    timing.loaded = instance != 0;
+    recordPluginLoadTiming(timing);
+    return instance;
 }
@@ -26,26 +26,78 @@
 #include "kpeople_export.h"
 
 #include <QHash>
+#include <QVariantList>
+
+#include <KService>
 
 namespace KPeople
 {
 
 class AbstractPersonAction;
 class BasePersonsDataSource;
+class ContactId;
+
+/**
+ * How long discovering or loading a plugin took, in microseconds.
+ *
+ * The service query is recorded in an entry of its own, with an empty plugin name.
+ */
+struct KPEOPLE_EXPORT PluginLoadTiming
+{
+    PluginLoadTiming();
+
+    QString serviceType;
+    QString plugin;
+    qint64 queryTime;
+    qint64 libraryLoadTime;
+    qint64 factoryTime;
+    qint64 constructorTime;
+    bool loaded;
+};
 
 class KPEOPLE_EXPORT PersonPluginManager
 {
 public:
     static QList<BasePersonsDataSource*> dataSourcePlugins();
     static BasePersonsDataSource* dataSource(const QString &sourceId);
+    /** The data source @p contactId belongs to, found by its source index */
+    static BasePersonsDataSource* dataSource(const ContactId &contactId);
     static QList<AbstractPersonAction*> actions();
 
+    /**
+     * The timings of every plugin query and load so far, in the order they happened.
+     * Setting KPEOPLE_PLUGIN_PROFILE in the environment also prints them to stderr as they are recorded.
+     */
+    static QList<PluginLoadTiming> pluginLoadTimings();
+
+    /**
+     * KServiceTypeTrader::query() which records how long the query took
+     */
+    static KService::List queryServices(const QString &serviceType);
+
+    /**
+     * KService::createInstance() which records how long loading the library,
+     * getting the factory and constructing the plugin took
+     *
+     * @return the plugin, which still needs to be cast to the expected type
+     */
+    static QObject* createPluginInstance(const KService::Ptr &service, QObject *parent,
+                                         const QVariantList &args = QVariantList());
 
     /**
      * Instead of loading datasources from plugins, set sources manually
      * This is for unit tests only
+     *
+     * The manager takes ownership of @p dataSources. The sources they replace are
+     * only deleted on exit, as other threads might still be using them
      */
     static void setDataSourcePlugins(const QHash<QString, BasePersonsDataSource*> &dataSources);
+
+    /**
+     * Instead of loading action plugins, set them manually
+     * This is for unit tests only, ownership works as with setDataSourcePlugins()
+     */
+    static void setActionPlugins(const QList<AbstractPersonAction*> &actionPlugins);
 };
 }
 
@@ -55,12 +55,13 @@ PersonsModel::PersonsModel(QObject *parent):
             connect(monitor.data(), SIGNAL(initialFetchComplete(bool)),
                     this, SLOT(onMonitorInitialFetchComplete(bool)));
         }
+        connect(monitor.data(), SIGNAL(loadProgress(int,int)), SLOT(onMonitorLoadProgress()));
         d->m_sourceMonitors << monitor;
     }
     onContactsFetched();
 
-    connect(PersonManager::instance(), SIGNAL(contactAddedToPerson(QString,QString)), SLOT(onAddContactToPerson(QString,QString)));
-    connect(PersonManager::instance(), SIGNAL(contactRemovedFromPerson(QString)), SLOT(onRemoveContactsFromPerson(QString)));
+    connect(PersonManager::instance(), SIGNAL(contactsAddedToPerson(QString,QStringList)), SLOT(onAddContactsToPerson(QString,QStringList)));
+    connect(PersonManager::instance(), SIGNAL(contactsRemovedFromPerson(QStringList)), SLOT(onRemoveContactsFromPerson(QStringList)));
 }
 
 PersonsModel::~PersonsModel()
@@ -92,7 +93,7 @@ QVariant PersonsModel::data(const QModelIndex &index, int role) const
         }
         const MetaContact &mc = d->metacontacts.at(index.parent().row());
 
-        return dataForAddressee(mc.id(), mc.contacts().at(index.row()), role);
+        return dataForAddressee(mc.id(), mc.contactAt(index.row()), role);
     } else {
         const MetaContact &mc = d->metacontacts.at(index.row());
         return dataForAddressee(mc.id(), mc.personAddressee(), role);
@@ -142,7 +143,7 @@ int PersonsModel::rowCount(const QModelIndex &parent) const
     }
 
     if (parent.isValid() && !parent.parent().isValid()) {
-        return d->metacontacts.at(parent.row()).contacts().count();
+        return d->metacontacts.at(parent.row()).contactCount();
     }
 
     return 0;
@@ -155,6 +156,36 @@ bool PersonsModel::isInitialized() const
     return d->isInitialized;
 }
 
+int PersonsModel::loadedContactsCount() const
+{
+    Q_D(const PersonsModel);
+
+    int loaded = 0;
+    Q_FOREACH (const AllContactsMonitorPtr &monitor, d->m_sourceMonitors) {
+        //a finished source has all its contacts, whether or not it reported its progress
+        loaded += monitor->isInitialFetchComplete() ? monitor->count() : monitor->loadedCount();
+    }
+    return loaded;
+}
+
+int PersonsModel::expectedContactsCount() const
+{
+    Q_D(const PersonsModel);
+
+    int expected = 0;
+    Q_FOREACH (const AllContactsMonitorPtr &monitor, d->m_sourceMonitors) {
+        //a finished source won't load any more
+        if (monitor->isInitialFetchComplete()) {
+            expected += monitor->count();
+        } else if (monitor->expectedCount() < 0) {
+            return -1;
+        } else {
+            expected += monitor->expectedCount();
+        }
+    }
+    return expected;
+}
+
 QModelIndex PersonsModel::index(int row, int column, const QModelIndex &parent) const
 {
     if (row < 0 || column < 0 || row >= rowCount(parent)) {
@@ -186,49 +217,105 @@ void PersonsModel::onMonitorInitialFetchComplete(bool success)
         d->hasError = true;
     }
     Q_ASSERT(d->initialFetchesDoneCount <= d->m_sourceMonitors.count());
+    onMonitorLoadProgress();
     if (d->initialFetchesDoneCount == d->m_sourceMonitors.count()) {
         d->isInitialized = true;
         Q_EMIT modelInitialized(!d->hasError);
     }
 }
 
-void PersonsModel::onContactsFetched()
+void PersonsModel::onMonitorLoadProgress()
 {
-    Q_D(PersonsModel);
-
-    KABC::Addressee::Map addresseeMap;
+    Q_EMIT loadProgress(loadedContactsCount(), expectedContactsCount());
+}
 
-    //fetch all already loaded contacts from plugins
-    Q_FOREACH (const AllContactsMonitorPtr &contactWatcher, d->m_sourceMonitors) {
-        addresseeMap.unite(contactWatcher->contacts());
+/**
+ * Builds the persons of the model while PersonManager reads them from the database,
+ * looking up their contacts in the monitors of the data sources
+ */
+class MetaContactBuilder : public PersonVisitor
+{
+public:
+    MetaContactBuilder(const QList<AllContactsMonitorPtr> &monitors,
+                       QHash<QString, QString> &contactToPersons,
+                       QList<MetaContact> &persons) :
+        m_monitors(monitors),
+        m_contactToPersons(contactToPersons),
+        m_persons(persons)
+    {
     }
 
-    //add metacontacts
-    QMultiHash<QString, QString> contactMapping = PersonManager::instance()->allPersons();
-
-    Q_FOREACH (const QString &key, contactMapping.uniqueKeys()) {
+    virtual void visitPerson(const QString &personId, const QStringList &contactIds)
+    {
         KABC::Addressee::Map contacts;
-        Q_FOREACH (const QString &contact, contactMapping.values(key)) {
-            d->contactToPersons[contact] = key;
-            if (addresseeMap.contains(contact)) {
-                contacts[contact] = addresseeMap.take(contact);
+        Q_FOREACH (const QString &contactId, contactIds) {
+            m_contactToPersons.insert(contactId, personId);
+            //a single lookup per monitor, contacts which aren't loaded are empty
+            Q_FOREACH (const AllContactsMonitorPtr &monitor, m_monitors) {
+                const KABC::Addressee contact = monitor->contact(contactId);
+                if (!contact.isEmpty()) {
+                    contacts.insert(contactId, contact);
+                    break;
+                }
             }
         }
         if (!contacts.isEmpty()) {
-            addPerson(MetaContact(key, contacts));
+            m_persons << MetaContact(personId, contacts);
+        }
+    }
+
+private:
+    const QList<AllContactsMonitorPtr> &m_monitors;
+    QHash<QString, QString> &m_contactToPersons;
+    QList<MetaContact> &m_persons;
+};
+
+/**
+ * Adds a person of its own for every contact which isn't part of a stored person
+ */
+class SingleContactBuilder : public ContactVisitor
+{
+public:
+    SingleContactBuilder(const QHash<QString, QString> &contactToPersons,
+                         QList<MetaContact> &persons) :
+        m_contactToPersons(contactToPersons),
+        m_persons(persons)
+    {
+    }
+
+    virtual void visitContact(const QString &contactId, const KABC::Addressee &contact)
+    {
+        if (!m_contactToPersons.contains(contactId)) {
+            m_persons << MetaContact(contactId, contact);
         }
     }
 
+private:
+    const QHash<QString, QString> &m_contactToPersons;
+    QList<MetaContact> &m_persons;
+};
+
+void PersonsModel::onContactsFetched()
+{
+    Q_D(PersonsModel);
+
+    //add metacontacts, reading their contacts from the already loaded contacts of the plugins
+    QList<MetaContact> persons;
+    MetaContactBuilder builder(d->m_sourceMonitors, d->contactToPersons, persons);
+    PersonManager::instance()->visitPersons(builder);
+
     //add remaining contacts
-    KABC::Addressee::Map::const_iterator i;
-    for (i = addresseeMap.constBegin(); i != addresseeMap.constEnd(); ++i) {
-        addPerson(MetaContact(i.key(), i.value()));
+    SingleContactBuilder singleContacts(d->contactToPersons, persons);
+    Q_FOREACH (const AllContactsMonitorPtr &contactWatcher, d->m_sourceMonitors) {
+        contactWatcher->visitContacts(singleContacts);
     }
 
+    addPersons(persons);
+
     Q_FOREACH(const AllContactsMonitorPtr monitor, d->m_sourceMonitors) {
-        connect(monitor.data(), SIGNAL(contactAdded(QString,KABC::Addressee)), SLOT(onContactAdded(QString,KABC::Addressee)));
-        connect(monitor.data(), SIGNAL(contactChanged(QString,KABC::Addressee)), SLOT(onContactChanged(QString,KABC::Addressee)));
-        connect(monitor.data(), SIGNAL(contactRemoved(QString)), SLOT(onContactRemoved(QString)));
+        connect(monitor.data(), SIGNAL(contactsAdded(KABC::Addressee::Map)), SLOT(onContactsAdded(KABC::Addressee::Map)));
+        connect(monitor.data(), SIGNAL(contactsChanged(KABC::Addressee::Map)), SLOT(onContactsChanged(KABC::Addressee::Map)));
+        connect(monitor.data(), SIGNAL(contactsRemoved(QStringList)), SLOT(onContactsRemoved(QStringList)));
     }
 }
 
@@ -243,11 +330,11 @@ void PersonsModel::onContactAdded(const QString &contactId, const KABC::Addresse
         MetaContact &mc = d->metacontacts[personRow];
 
         //if the MC object already contains this object, we want to update the row, not do an insert
-        if (mc.contactIds().contains(contactId)) {
+        if (mc.indexOfContact(contactId) >= 0) {
             kWarning() << "Source emitted contactAdded for a contact we already know about " << contactId;
             onContactChanged(contactId, contact);
         } else {
-            int newContactPos = mc.contacts().size();
+            int newContactPos = mc.contactCount();
             beginInsertRows(index(personRow), newContactPos, newContactPos);
             mc.insertContact(contactId, contact);
             endInsertRows();
@@ -286,7 +373,7 @@ void PersonsModel::onContactRemoved(const QString &contactId)
     int personRow = d->personIndex[personId].row();
 
     MetaContact &mc = d->metacontacts[personRow];
-    int contactPosition = mc.contactIds().indexOf(contactId);
+    int contactPosition = mc.indexOfContact(contactId);
     beginRemoveRows(index(personRow, 0), contactPosition, contactPosition);
     mc.removeContact(contactId);
     endRemoveRows();
@@ -298,103 +385,236 @@ void PersonsModel::onContactRemoved(const QString &contactId)
     personChanged(personId);
 }
 
-void PersonsModel::onAddContactToPerson(const QString &contactId, const QString &newPersonId)
+void PersonsModel::onContactsAdded(const KABC::Addressee::Map &contacts)
 {
     Q_D(PersonsModel);
 
-    const QString oldPersonId = personIdForContact(contactId);
+    //contacts of persons which are not in the model yet are collected and inserted as new rows at once
+    QHash<QString, KABC::Addressee::Map> newPersons;
+    QStringList newPersonIds;
 
-    d->contactToPersons.insert(contactId, newPersonId);
+    KABC::Addressee::Map::const_iterator it = contacts.constBegin();
+    for (; it != contacts.constEnd(); ++it) {
+        const QString personId = personIdForContact(it.key());
+        if (d->personIndex.contains(personId)) {
+            onContactAdded(it.key(), it.value());
+            continue;
+        }
 
-    int oldPersonRow = d->personIndex[oldPersonId].row();
+        QHash<QString, KABC::Addressee::Map>::iterator person = newPersons.find(personId);
+        if (person == newPersons.end()) {
+            person = newPersons.insert(personId, KABC::Addressee::Map());
+            newPersonIds << personId;
+        }
+        person.value().insert(it.key(), it.value());
+    }
 
-    if (oldPersonRow < 0) {
+    if (newPersonIds.isEmpty()) {
         return;
     }
 
-    MetaContact &oldMc = d->metacontacts[oldPersonRow];
+    QList<MetaContact> persons;
+    persons.reserve(newPersonIds.size());
+    Q_FOREACH (const QString &personId, newPersonIds) {
+        persons << MetaContact(personId, newPersons.value(personId));
+    }
+    addPersons(persons);
+}
 
-    //get contact already in the model, remove it from the previous contact
-    int contactPosition = oldMc.contactIds().indexOf(contactId);
-    const KABC::Addressee contact = oldMc.contacts().at(contactPosition);
+void PersonsModel::onContactsChanged(const KABC::Addressee::Map &contacts)
+{
+    KABC::Addressee::Map::const_iterator it = contacts.constBegin();
+    for (; it != contacts.constEnd(); ++it) {
+        onContactChanged(it.key(), it.value());
+    }
+}
 
-    beginRemoveRows(index(oldPersonRow), contactPosition, contactPosition);
-    oldMc.removeContact(contactId);
-    endRemoveRows();
+void PersonsModel::onContactsRemoved(const QStringList &contactIds)
+{
+    Q_FOREACH (const QString &contactId, contactIds) {
+        onContactRemoved(contactId);
+    }
+}
 
-    if (!oldMc.isValid()) {
-        removePerson(oldPersonId);
-    } else {
-        personChanged(oldPersonId);
+void PersonsModel::onAddContactsToPerson(const QString &newPersonId, const QStringList &contactIds)
+{
+    Q_D(PersonsModel);
+
+    //take all the contacts out of their previous persons first, then add them to the new person in one go
+    QHash<QString, QStringList> contactsByOldPerson;
+    Q_FOREACH (const QString &contactId, contactIds) {
+        const QString oldPersonId = personIdForContact(contactId);
+        d->contactToPersons.insert(contactId, newPersonId);
+        if (oldPersonId != newPersonId) {
+            contactsByOldPerson[oldPersonId] << contactId;
+        }
+    }
+
+    KABC::Addressee::Map movedContacts;
+    QStringList emptiedPersons;
+    QHash<QString, QStringList>::const_iterator it = contactsByOldPerson.constBegin();
+    for (; it != contactsByOldPerson.constEnd(); ++it) {
+        const QString &oldPersonId = it.key();
+        const QPersistentModelIndex oldPersonIndex = d->personIndex.value(oldPersonId);
+        if (!oldPersonIndex.isValid()) {
+            continue;
+        }
+
+        //get the contacts already in the model
+        const int oldPersonRow = oldPersonIndex.row();
+        MetaContact &oldMc = d->metacontacts[oldPersonRow];
+        QStringList leavingContacts;
+        Q_FOREACH (const QString &contactId, it.value()) {
+            const int contactPosition = oldMc.indexOfContact(contactId);
+            if (contactPosition >= 0) {
+                movedContacts[contactId] = oldMc.contactAt(contactPosition);
+                leavingContacts << contactId;
+            }
+        }
+
+        //the common case is merging contacts which were a person of their own, their rows
+        //are dropped together below
+        if (leavingContacts.size() == oldMc.contactCount()) {
+            emptiedPersons << oldPersonId;
+        } else if (!leavingContacts.isEmpty()) {
+            Q_FOREACH (const QString &contactId, leavingContacts) {
+                const int contactPosition = oldMc.indexOfContact(contactId);
+                beginRemoveRows(index(oldPersonRow), contactPosition, contactPosition);
+                oldMc.removeContact(contactId);
+                endRemoveRows();
+            }
+            personChanged(oldPersonId);
+        }
     }
+    removePersons(emptiedPersons);
 
-    //if the new person is already in the model, add the contact to it
+    if (movedContacts.isEmpty()) {
+        return;
+    }
+
+    //if the new person is already in the model, add the contacts to it
     if (d->personIndex.contains(newPersonId)) {
-        int newPersonRow = d->personIndex[newPersonId].row();
+        const int newPersonRow = d->personIndex.value(newPersonId).row();
         MetaContact &newMc = d->metacontacts[newPersonRow];
-        int newContactPos = newMc.contacts().size();
-        beginInsertRows(index(newPersonRow), newContactPos, newContactPos);
-        newMc.insertContact(contactId, contact);
+        const int newContactPos = newMc.contactCount();
+        beginInsertRows(index(newPersonRow), newContactPos, newContactPos + movedContacts.size() - 1);
+        newMc.insertContacts(movedContacts);
         endInsertRows();
         personChanged(newPersonId);
     } else { //if the person is not in the model, create a new person and insert it
-        KABC::Addressee::Map contacts;
-        contacts[contactId] = contact;
-        addPerson(MetaContact(newPersonId, contacts));
+        addPerson(MetaContact(newPersonId, movedContacts));
     }
 }
 
 
-void PersonsModel::onRemoveContactsFromPerson(const QString &contactId)
+void PersonsModel::onRemoveContactsFromPerson(const QStringList &contactIds)
 {
     Q_D(PersonsModel);
 
-    const QString personId = personIdForContact(contactId);
-    int personRow = d->personIndex[personId].row();
-    MetaContact &mc = d->metacontacts[personRow];
+    QHash<QString, QStringList> contactsByPerson;
+    Q_FOREACH (const QString &contactId, contactIds) {
+        const QString personId = personIdForContact(contactId);
+        d->contactToPersons.remove(contactId);
 
-    const KABC::Addressee &contact = mc.contact(contactId);
-    mc.removeContact(contactId);
-    d->contactToPersons.remove(contactId);
+        //the contact is a person of its own already
+        if (personId != contactId) {
+            contactsByPerson[personId] << contactId;
+        }
+    }
 
-    //if we don't want the person object anymore
-    if (!mc.isValid()) {
-        removePerson(personId);
-    } else {
-        personChanged(personId);
+    QList<MetaContact> unmergedContacts;
+    QStringList emptiedPersons;
+    QHash<QString, QStringList>::const_iterator it = contactsByPerson.constBegin();
+    for (; it != contactsByPerson.constEnd(); ++it) {
+        const QString &personId = it.key();
+        const QPersistentModelIndex personIndex = d->personIndex.value(personId);
+        if (!personIndex.isValid()) {
+            continue;
+        }
+
+        const int personRow = personIndex.row();
+        MetaContact &mc = d->metacontacts[personRow];
+        QStringList leavingContacts;
+        Q_FOREACH (const QString &contactId, it.value()) {
+            const int contactPosition = mc.indexOfContact(contactId);
+            if (contactPosition >= 0) {
+                unmergedContacts << MetaContact(contactId, mc.contactAt(contactPosition));
+                leavingContacts << contactId;
+            }
+        }
+
+        //if we don't want the person object anymore, its row goes along with the others below
+        if (leavingContacts.size() == mc.contactCount()) {
+            emptiedPersons << personId;
+        } else if (!leavingContacts.isEmpty()) {
+            Q_FOREACH (const QString &contactId, leavingContacts) {
+                const int contactPosition = mc.indexOfContact(contactId);
+                beginRemoveRows(index(personRow), contactPosition, contactPosition);
+                mc.removeContact(contactId);
+                endRemoveRows();
+            }
+            personChanged(personId);
+        }
     }
+    removePersons(emptiedPersons);
 
-    //now re-insert as a new contact
-    //we know it's not part of a metacontact anymore so reinsert as a contact
-    addPerson(MetaContact(contactId, contact));
+    //now re-insert as new contacts
+    //we know they're not part of a metacontact anymore so reinsert them as contacts, all in one go
+    addPersons(unmergedContacts);
 }
 
 void PersonsModel::addPerson(const KPeople::MetaContact &mc)
+{
+    addPersons(QList<MetaContact>() << mc);
+}
+
+void PersonsModel::addPersons(const QList<MetaContact> &persons)
 {
     Q_D(PersonsModel);
 
-    const QString &id = mc.id();
+    if (persons.isEmpty()) {
+        return;
+    }
 
-    int row = d->metacontacts.size();
-    beginInsertRows(QModelIndex(), row, row);
-    d->metacontacts.append(mc);
-    d->personIndex[id] = index(row);
+    const int firstRow = d->metacontacts.size();
+    beginInsertRows(QModelIndex(), firstRow, firstRow + persons.size() - 1);
+    d->metacontacts.append(persons);
+    for (int row = firstRow; row < d->metacontacts.size(); row++) {
+        d->personIndex[d->metacontacts.at(row).id()] = index(row);
+    }
     endInsertRows();
 }
 
 void PersonsModel::removePerson(const QString& id)
+{
+    removePersons(QStringList() << id);
+}
+
+void PersonsModel::removePersons(const QStringList &ids)
 {
     Q_D(PersonsModel);
 
-    QPersistentModelIndex index = d->personIndex.value(id);
-    if (!index.isValid()) { //item not found
-        return;
+    QList<int> rows;
+    Q_FOREACH (const QString &id, ids) {
+        const QPersistentModelIndex index = d->personIndex.take(id);
+        if (index.isValid()) { //item found
+            rows << index.row();
+        }
+    }
+    qSort(rows);
+
+    //adjacent rows are removed together, from the bottom up so the rows above stay where they are
+    int last = rows.size() - 1;
+    while (last >= 0) {
+        int first = last;
+        while (first > 0 && rows.at(first - 1) == rows.at(first) - 1) {
+            first--;
+        }
+        beginRemoveRows(QModelIndex(), rows.at(first), rows.at(last));
+        d->metacontacts.erase(d->metacontacts.begin() + rows.at(first), d->metacontacts.begin() + rows.at(last) + 1);
+        endRemoveRows();
+        last = first - 1;
     }
-
-    beginRemoveRows(QModelIndex(), index.row(), index.row());
-    d->personIndex.remove(id);
-    d->metacontacts.removeAt(index.row());
-    endRemoveRows();
 }
 
 void PersonsModel::personChanged(const QString &personId)
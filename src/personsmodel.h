@@ -72,9 +72,26 @@ public:
 
     bool isInitialized() const;
 
+    /**
+     * The number of contacts the data sources have loaded so far
+     */
+    int loadedContactsCount() const;
+
+    /**
+     * The number of contacts the data sources expect to load in total,
+     * -1 while a data source which doesn't know its total is still loading
+     */
+    int expectedContactsCount() const;
+
 Q_SIGNALS:
     void modelInitialized(bool success);
 
+    /**
+     * Emitted while the data sources load their contacts, with the sum over all of them
+     * as returned by loadedContactsCount() and expectedContactsCount()
+     */
+    void loadProgress(int loaded, int expected);
+
 private Q_SLOTS:
     void onContactsFetched();
 
@@ -82,19 +99,26 @@ private Q_SLOTS:
     void onContactAdded(const QString &contactId, const KABC::Addressee &contact);
     void onContactChanged(const QString &contactId, const KABC::Addressee &contact);
     void onContactRemoved(const QString &contactId);
+    void onContactsAdded(const KABC::Addressee::Map &contacts);
+    void onContactsChanged(const KABC::Addressee::Map &contacts);
+    void onContactsRemoved(const QStringList &contactIds);
 
     //update on metadata changes
-    void onAddContactToPerson(const QString &contactId, const QString &newPersonId);
-    void onRemoveContactsFromPerson(const QString &contactId);
+    void onAddContactsToPerson(const QString &newPersonId, const QStringList &contactIds);
+    void onRemoveContactsFromPerson(const QStringList &contactIds);
 
     void onMonitorInitialFetchComplete(bool success = true);
+    void onMonitorLoadProgress();
 
 private:
     Q_DISABLE_COPY(PersonsModel)
 
     //methods that manipulate the model
     void addPerson(const MetaContact &mc);
+    void addPersons(const QList<MetaContact> &persons);
     void removePerson(const QString &id);
+    //one row removal for every range of adjacent rows
+    void removePersons(const QStringList &ids);
     void personChanged(const QString &personId);
 
     QString personIdForContact(const QString &contactId) const;
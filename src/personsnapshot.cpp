@@ -0,0 +1,292 @@
+/*
+    Copyright (C) 2013  David Edmundson <davidedmundson@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "personsnapshot_p.h"
+
+#include <QtAlgorithms>
+#include <string.h>
+#include <KSaveFile>
+#include <KDebug>
+
+namespace {
+
+//bump s_version whenever the layout changes, readers ignore files with a different version
+static const char s_magic[8] = { 'K', 'P', 'E', 'O', 'P', 'L', 'E', 'S' };
+static const quint32 s_version = 1;
+
+//the file is only read on the machine which wrote it, so everything is in host byte order
+struct SnapshotHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 count;
+    qint64 sequence;
+    quint32 entriesOffset;      //count entries, sorted by contact ID
+    quint32 personIndexOffset;  //count quint32 indexes into the entries, sorted by person
+    quint32 stringsOffset;      //UTF-16 contact IDs
+    quint32 stringsLength;      //in QChars
+};
+
+struct SnapshotEntry
+{
+    qint64 personId;
+    quint32 offset;             //in QChars from the start of the strings
+    quint32 length;
+};
+
+//sorts indexes into a list of contact IDs by the contact IDs
+class ContactIdLessThan
+{
+public:
+    ContactIdLessThan(const QStringList &contactIds) : m_contactIds(contactIds) {}
+    bool operator()(int left, int right) const
+    {
+        return m_contactIds.at(left) < m_contactIds.at(right);
+    }
+private:
+    const QStringList &m_contactIds;
+};
+
+//sorts indexes into the entries by person, stable so contacts of a person keep their order
+class PersonIdLessThan
+{
+public:
+    PersonIdLessThan(const QVector<SnapshotEntry> &entries) : m_entries(entries) {}
+    bool operator()(quint32 left, quint32 right) const
+    {
+        return m_entries.at(left).personId < m_entries.at(right).personId;
+    }
+private:
+    const QVector<SnapshotEntry> &m_entries;
+};
+
+}
+
+PersonSnapshot::PersonSnapshot(const QString &fileName):
+    m_file(fileName),
+    m_data(0),
+    m_size(0)
+{
+}
+
+PersonSnapshot::~PersonSnapshot()
+{
+    unmap();
+}
+
+bool PersonSnapshot::map()
+{
+    unmap();
+
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    m_size = m_file.size();
+    if (m_size >= qint64(sizeof(SnapshotHeader))) {
+        m_data = m_file.map(0, m_size);
+    }
+    //the mapping stays valid after the file is closed, and even after it is replaced
+    m_file.close();
+
+    if (!m_data) {
+        return false;
+    }
+
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader*>(m_data);
+    const qint64 count = header->count;
+    const bool valid = qstrncmp(header->magic, s_magic, sizeof(s_magic)) == 0 &&
+                       header->version == s_version &&
+                       header->entriesOffset % sizeof(qint64) == 0 &&
+                       header->entriesOffset + count * qint64(sizeof(SnapshotEntry)) <= m_size &&
+                       header->personIndexOffset % sizeof(quint32) == 0 &&
+                       header->personIndexOffset + count * qint64(sizeof(quint32)) <= m_size &&
+                       header->stringsOffset % sizeof(QChar) == 0 &&
+                       header->stringsOffset + qint64(header->stringsLength) * qint64(sizeof(QChar)) <= m_size;
+    if (!valid) {
+        kWarning() << "Ignoring invalid snapshot" << m_file.fileName();
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+void PersonSnapshot::unmap()
+{
+    if (m_data) {
+        //QFile::unmap() works on a closed file as long as it is the one which mapped it
+        m_file.unmap(const_cast<uchar*>(m_data));
+        m_data = 0;
+        m_size = 0;
+    }
+}
+
+bool PersonSnapshot::isMapped() const
+{
+    return m_data != 0;
+}
+
+qint64 PersonSnapshot::sequence() const
+{
+    return m_data ? reinterpret_cast<const SnapshotHeader*>(m_data)->sequence : 0;
+}
+
+int PersonSnapshot::count() const
+{
+    return m_data ? reinterpret_cast<const SnapshotHeader*>(m_data)->count : 0;
+}
+
+QString PersonSnapshot::contactIdOfEntry(quint32 entry) const
+{
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader*>(m_data);
+    const SnapshotEntry &e = reinterpret_cast<const SnapshotEntry*>(m_data + header->entriesOffset)[entry];
+    const QChar *strings = reinterpret_cast<const QChar*>(m_data + header->stringsOffset);
+    if (quint64(e.offset) + e.length > header->stringsLength) {
+        return QString();
+    }
+    //a deep copy, the mapping can go away while the string is still used
+    return QString(strings + e.offset, e.length);
+}
+
+qint64 PersonSnapshot::personIdForContact(const QString &contactId) const
+{
+    if (!m_data) {
+        return -1;
+    }
+
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader*>(m_data);
+    const SnapshotEntry *entries = reinterpret_cast<const SnapshotEntry*>(m_data + header->entriesOffset);
+    const QChar *strings = reinterpret_cast<const QChar*>(m_data + header->stringsOffset);
+
+    int low = 0;
+    int high = int(header->count) - 1;
+    while (low <= high) {
+        const int middle = low + (high - low) / 2;
+        const SnapshotEntry &entry = entries[middle];
+        if (quint64(entry.offset) + entry.length > header->stringsLength) {
+            return -1;
+        }
+        //no copy, only used for the comparison
+        const QString middleId = QString::fromRawData(strings + entry.offset, entry.length);
+        if (middleId < contactId) {
+            low = middle + 1;
+        } else if (contactId < middleId) {
+            high = middle - 1;
+        } else {
+            return entry.personId;
+        }
+    }
+    return -1;
+}
+
+QStringList PersonSnapshot::contactsForPersonId(qint64 personId) const
+{
+    QStringList contactIds;
+    if (!m_data) {
+        return contactIds;
+    }
+
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader*>(m_data);
+    const SnapshotEntry *entries = reinterpret_cast<const SnapshotEntry*>(m_data + header->entriesOffset);
+    const quint32 *personIndex = reinterpret_cast<const quint32*>(m_data + header->personIndexOffset);
+    const int count = header->count;
+
+    //find the first contact of the person
+    int low = 0;
+    int high = count;
+    while (low < high) {
+        const int middle = low + (high - low) / 2;
+        if (personIndex[middle] < quint32(count) && entries[personIndex[middle]].personId < personId) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    for (int i = low; i < count && personIndex[i] < quint32(count) && entries[personIndex[i]].personId == personId; i++) {
+        contactIds << contactIdOfEntry(personIndex[i]);
+    }
+    return contactIds;
+}
+
+qint64 PersonSnapshot::personIdAt(int index) const
+{
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader*>(m_data);
+    const SnapshotEntry *entries = reinterpret_cast<const SnapshotEntry*>(m_data + header->entriesOffset);
+    const quint32 entry = reinterpret_cast<const quint32*>(m_data + header->personIndexOffset)[index];
+    return entry < header->count ? entries[entry].personId : -1;
+}
+
+QString PersonSnapshot::contactIdAt(int index) const
+{
+    const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader*>(m_data);
+    const quint32 entry = reinterpret_cast<const quint32*>(m_data + header->personIndexOffset)[index];
+    return entry < header->count ? contactIdOfEntry(entry) : QString();
+}
+
+bool PersonSnapshot::write(const QString &fileName, qint64 sequence,
+                           const QStringList &contactIds, const QVector<qint64> &personIds)
+{
+    Q_ASSERT(contactIds.size() == personIds.size());
+    const int count = contactIds.size();
+
+    QVector<int> byContact(count);
+    for (int i = 0; i < count; i++) {
+        byContact[i] = i;
+    }
+    qSort(byContact.begin(), byContact.end(), ContactIdLessThan(contactIds));
+
+    QVector<SnapshotEntry> entries(count);
+    QString strings;
+    for (int i = 0; i < count; i++) {
+        const QString &contactId = contactIds.at(byContact.at(i));
+        entries[i].personId = personIds.at(byContact.at(i));
+        entries[i].offset = strings.size();
+        entries[i].length = contactId.size();
+        strings += contactId;
+    }
+
+    QVector<quint32> personIndex(count);
+    for (int i = 0; i < count; i++) {
+        personIndex[i] = i;
+    }
+    qStableSort(personIndex.begin(), personIndex.end(), PersonIdLessThan(entries));
+
+    SnapshotHeader header;
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.version = s_version;
+    header.count = count;
+    header.sequence = sequence;
+    header.entriesOffset = sizeof(SnapshotHeader);
+    header.personIndexOffset = header.entriesOffset + count * sizeof(SnapshotEntry);
+    header.stringsOffset = header.personIndexOffset + count * sizeof(quint32);
+    header.stringsLength = strings.size();
+
+    //KSaveFile writes to a temporary file and renames it over the old one, so readers
+    //never see a half written snapshot
+    KSaveFile file(fileName);
+    if (!file.open()) {
+        kWarning() << "Could not write snapshot" << fileName << file.errorString();
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.constData()), count * sizeof(SnapshotEntry));
+    file.write(reinterpret_cast<const char*>(personIndex.constData()), count * sizeof(quint32));
+    file.write(reinterpret_cast<const char*>(strings.constData()), strings.size() * sizeof(QChar));
+    return file.finalize();
+}
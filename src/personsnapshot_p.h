@@ -0,0 +1,85 @@
+/*
+    Copyright (C) 2013  David Edmundson <davidedmundson@kde.org>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef PERSONSNAPSHOT_H
+#define PERSONSNAPSHOT_H
+
+#include <QFile>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * A read-only copy of the contact <---> person mapping in a binary file,
+ * which other processes can map into memory instead of opening the database.
+ *
+ * The file holds all contacts sorted by their ID, each with the person it belongs to,
+ * and an index of those contacts sorted by person. Lookups in either direction are
+ * binary searches in the mapped file and don't read anything from disk after page-in.
+ *
+ * The file is only ever replaced as a whole, a mapped snapshot stays valid but
+ * doesn't see newer changes until it is mapped again.
+ */
+class PersonSnapshot
+{
+public:
+    explicit PersonSnapshot(const QString &fileName);
+    ~PersonSnapshot();
+
+    /**
+     * Maps the current file, replacing the previous mapping.
+     * @return false if there is no file or it is not a valid snapshot
+     */
+    bool map();
+    void unmap();
+    bool isMapped() const;
+
+    /** The journal sequence of the database when the snapshot was written */
+    qint64 sequence() const;
+
+    /** The number of contacts which are part of a person */
+    int count() const;
+
+    /** Returns the person of @p contactId, or -1 if it is not part of any person */
+    qint64 personIdForContact(const QString &contactId) const;
+    QStringList contactsForPersonId(qint64 personId) const;
+
+    /**
+     * The contacts ordered by person, for going through all of them.
+     * @p index goes from 0 to count()
+     */
+    qint64 personIdAt(int index) const;
+    QString contactIdAt(int index) const;
+
+    /**
+     * Writes a snapshot of @p contactIds, each belonging to the person in @p personIds
+     * at the same index, and replaces the file at @p fileName with it atomically
+     */
+    static bool write(const QString &fileName, qint64 sequence,
+                      const QStringList &contactIds, const QVector<qint64> &personIds);
+
+private:
+    Q_DISABLE_COPY(PersonSnapshot)
+
+    QString contactIdOfEntry(quint32 entry) const;
+
+    QFile m_file;
+    const uchar *m_data;
+    qint64 m_size;
+};
+
+#endif // PERSONSNAPSHOT_H
@@ -24,6 +24,7 @@
 #include <Akonadi/Collection>
 #include <Akonadi/CollectionFetchJob>
 #include <Akonadi/CollectionFetchScope>
+#include <Akonadi/CollectionStatistics>
 #include <Akonadi/ServerManager>
 
 #include <KABC/Addressee>
@@ -42,6 +43,10 @@ public:
     AkonadiAllContacts();
     ~AkonadiAllContacts();
     virtual KABC::Addressee::Map contacts();
+    virtual KABC::Addressee contact(const QString &contactId);
+    virtual bool contains(const QString &contactId);
+    virtual int count();
+    virtual void visitContacts(KPeople::ContactVisitor &visitor);
 private Q_SLOTS:
     void onCollectionsFetched(KJob* job);
     void onItemsFetched(KJob* job);
@@ -50,15 +55,21 @@ private Q_SLOTS:
     void onItemRemoved(const Akonadi::Item &item);
     void onServerStateChanged(Akonadi::ServerManager::State);
 private:
+    QString storeContact(const Akonadi::Item &item, KABC::Addressee *contact);
     Akonadi::Monitor *m_monitor;
     KABC::Addressee::Map m_contacts;
     int m_activeFetchJobsCount;
+    //items fetched so far and the sum of the item counts of all collections (-1 if unknown), for the load progress
+    int m_fetchedItemsCount;
+    int m_expectedItemsCount;
     bool m_fetchError;
 };
 
 AkonadiAllContacts::AkonadiAllContacts():
     m_monitor(new Akonadi::Monitor(this)),
     m_activeFetchJobsCount(0),
+    m_fetchedItemsCount(0),
+    m_expectedItemsCount(0),
     m_fetchError(false)
 {
     connect(Akonadi::ServerManager::self(), SIGNAL(stateChanged(Akonadi::ServerManager::State)), SLOT(onServerStateChanged(Akonadi::ServerManager::State)));
@@ -77,6 +88,7 @@ AkonadiAllContacts::AkonadiAllContacts():
 
     CollectionFetchJob *fetchJob = new CollectionFetchJob(Collection::root(), CollectionFetchJob::Recursive, this);
     fetchJob->fetchScope().setContentMimeTypes( QStringList() << "text/directory" );
+    fetchJob->fetchScope().setIncludeStatistics(true);
     connect(fetchJob, SIGNAL(finished(KJob*)), SLOT(onCollectionsFetched(KJob*)));
 }
 
@@ -89,32 +101,63 @@ KABC::Addressee::Map AkonadiAllContacts::contacts()
     return m_contacts;
 }
 
+KABC::Addressee AkonadiAllContacts::contact(const QString &contactId)
+{
+    return m_contacts.value(contactId);
+}
+
+bool AkonadiAllContacts::contains(const QString &contactId)
+{
+    return m_contacts.contains(contactId);
+}
+
+int AkonadiAllContacts::count()
+{
+    return m_contacts.size();
+}
+
+void AkonadiAllContacts::visitContacts(KPeople::ContactVisitor &visitor)
+{
+    KABC::Addressee::Map::const_iterator it = m_contacts.constBegin();
+    for (; it != m_contacts.constEnd(); ++it) {
+        visitor.visitContact(it.key(), it.value());
+    }
+}
+
 QString AkonadiDataSource::sourcePluginId() const
 {
     return "akonadi";
 }
 
 
-void AkonadiAllContacts::onItemAdded(const Item& item)
+//stores the contact of the item, returns its id or an empty string if the item has no contact
+QString AkonadiAllContacts::storeContact(const Item &item, KABC::Addressee *contact)
 {
     if(!item.hasPayload<KABC::Addressee>()) {
-        return;
+        return QString();
     }
     const QString id = item.url().prettyUrl();
-    const KABC::Addressee contact = item.payload<KABC::Addressee>();
-    m_contacts[id] = contact;
-    Q_EMIT contactAdded(item.url().prettyUrl(), contact);
+    *contact = item.payload<KABC::Addressee>();
+    m_contacts[id] = *contact;
+    return id;
+}
+
+void AkonadiAllContacts::onItemAdded(const Item& item)
+{
+    KABC::Addressee contact;
+    const QString id = storeContact(item, &contact);
+    if (!id.isEmpty()) {
+        Q_EMIT contactAdded(id, contact);
+    }
 }
 
 void AkonadiAllContacts::onItemChanged(const Item& item)
 {
-    if(!item.hasPayload<KABC::Addressee>()) {
-        return;
+    KABC::Addressee contact;
+    const QString id = storeContact(item, &contact);
+    if (!id.isEmpty()) {
+        Q_EMIT contactChanged(id, contact);
     }
-    const QString id = item.url().prettyUrl();
-    const KABC::Addressee contact = item.payload<KABC::Addressee>();
-    m_contacts[id] = contact;
-    Q_EMIT contactChanged(item.url().prettyUrl(), contact);
 }
 
 void AkonadiAllContacts::onItemRemoved(const Item& item)
@@ -135,9 +178,21 @@ void AkonadiAllContacts::onItemsFetched(KJob *job)
         m_fetchError = true;
     } else {
         ItemFetchJob *itemFetchJob = qobject_cast<ItemFetchJob*>(job);
+        //announce the whole collection at once
+        KABC::Addressee::Map contacts;
         foreach (const Item &item, itemFetchJob->items()) {
-            onItemAdded(item);
+            KABC::Addressee contact;
+            const QString id = storeContact(item, &contact);
+            if (!id.isEmpty()) {
+                contacts.insert(id, contact);
+            }
         }
+        emitContactsAdded(contacts);
+
+        m_fetchedItemsCount += itemFetchJob->items().count();
+        //items added since the statistics were read can make the fetch larger than expected
+        const int expected = m_expectedItemsCount < 0 ? -1 : qMax(m_expectedItemsCount, m_fetchedItemsCount);
+        setLoadProgress(m_fetchedItemsCount, expected);
     }
 
     if (--m_activeFetchJobsCount == 0 && !isInitialFetchComplete()) {
@@ -160,12 +215,20 @@ void AkonadiAllContacts::onCollectionsFetched(KJob* job)
                 continue;
             }
             if (collection.contentMimeTypes().contains( KABC::Addressee::mimeType() ) ) {
+                //the total is unknown as soon as one collection has no statistics
+                const qint64 itemCount = collection.statistics().count();
+                if (itemCount < 0 || m_expectedItemsCount < 0) {
+                    m_expectedItemsCount = -1;
+                } else {
+                    m_expectedItemsCount += itemCount;
+                }
                 ItemFetchJob *itemFetchJob = new ItemFetchJob(collection);
                 itemFetchJob->fetchScope().fetchFullPayload();
                 connect(itemFetchJob, SIGNAL(finished(KJob*)), SLOT(onItemsFetched(KJob*)));
                 ++m_activeFetchJobsCount;
             }
         }
+        setLoadProgress(0, m_expectedItemsCount);
         if (m_activeFetchJobsCount == 0) {
             emitInitialFetchComplete(true);
         }
@@ -28,7 +28,6 @@
 #include <KLocalizedString>
 #include <KStandardDirs>
 #include <KService>
-#include <KServiceTypeTrader>
 #include <KPluginInfo>
 #include <KPluginLoader>
 #include <KPluginFactory>
@@ -36,6 +35,7 @@
 #include "abstractfieldwidgetfactory.h"
 #include "plugins/emaildetailswidget.h"
 #include "global.h"
+#include "personpluginmanager_p.h"
 
 #include "ui_person-details-presentation.h"
 
@@ -124,15 +124,17 @@ PersonDetailsView::PersonDetailsView(QWidget *parent)
     d->m_plugins << new EmailFieldsPlugin();
 
     // load every KPeopleWidgets Plugin
-    KService::List pluginList = KServiceTypeTrader::self()->query( QLatin1String("KPeopleWidgets/Plugin"));
+    KService::List pluginList = PersonPluginManager::queryServices(QLatin1String("KPeopleWidgets/Plugin"));
 
     QList<KPluginInfo> plugins = KPluginInfo::fromServices(pluginList);
 
     Q_FOREACH(const KPluginInfo &p, plugins) {
-        QString error;
-        AbstractFieldWidgetFactory *f = p.service()->createInstance<AbstractFieldWidgetFactory>(this, QVariantList(), &error);
+        QObject *instance = PersonPluginManager::createPluginInstance(p.service(), this);
+        AbstractFieldWidgetFactory *f = qobject_cast<AbstractFieldWidgetFactory*>(instance);
         if (f) {
             d->m_plugins << f;
+        } else {
+            delete instance;
         }
     }
 